@@ -0,0 +1,361 @@
+/*
+ * Latency benchmark for the TLSF allocator.
+ *
+ * Replays a set of synthetic traces (and optionally a recorded one) against
+ * a private TLSF instance and prints min, median, p99 and max cycles per
+ * call for malloc, free, realloc and memalign, plus the peak fragmentation
+ * seen while the trace ran.
+ *
+ *     make -C bench BOARD=native all term
+ *     make -C bench BOARD=<board> flash term
+ *
+ * Build options (via BENCH_CFLAGS):
+ *   BENCH_CYCLES()     expression returning a free-running uint32_t cycle
+ *                      counter; defaults to the TSC on x86 and DWT->CYCCNT
+ *                      on ARMv7-M
+ *   BENCH_HEAP_SIZE    heap size in bytes
+ *   BENCH_STEPS        operations per synthetic trace
+ *   BENCH_SLOTS        maximum number of live allocations
+ *   BENCH_MAX_SIZE     largest request size of the synthetic traces
+ *   BENCH_SAMPLES      latency samples kept per operation for percentiles
+ *   BENCH_TRACE        header defining "static const bench_op_t
+ *                      bench_trace[]", e.g. as written by the replay tool
+ *
+ * Allocator options go into BENCH_CFLAGS as well, so configurations can be
+ * compared directly, e.g. BENCH_CFLAGS=-DTLSF_SL_INDEX_COUNT_LOG2=6.
+ *
+ * min and max cover every call; median and p99 are taken from a uniform
+ * reservoir sample of BENCH_SAMPLES calls.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tlsf.h"
+
+#ifndef BENCH_HEAP_SIZE
+#define BENCH_HEAP_SIZE     (16 * 1024)
+#endif
+
+#ifndef BENCH_STEPS
+#define BENCH_STEPS         (20000)
+#endif
+
+#ifndef BENCH_SLOTS
+#define BENCH_SLOTS         (64)
+#endif
+
+#ifndef BENCH_MAX_SIZE
+#define BENCH_MAX_SIZE      (512)
+#endif
+
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES       (512)
+#endif
+
+/* fragmentation is sampled every BENCH_FRAG_PERIOD steps, outside timing */
+#ifndef BENCH_FRAG_PERIOD
+#define BENCH_FRAG_PERIOD   (32)
+#endif
+
+#ifndef BENCH_CYCLES
+#if defined(__i386__) || defined(__x86_64__)
+#define BENCH_CYCLES()      ((uint32_t)__builtin_ia32_rdtsc())
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define BENCH_DWT_CTRL      (*(volatile uint32_t *)0xE0001000)
+#define BENCH_DWT_CYCCNT    (*(volatile uint32_t *)0xE0001004)
+#define BENCH_DEMCR         (*(volatile uint32_t *)0xE000EDFC)
+#define BENCH_CYCLES()      (BENCH_DWT_CYCCNT)
+#define BENCH_CYCLES_INIT() do { BENCH_DEMCR |= (1UL << 24); \
+                                 BENCH_DWT_CYCCNT = 0; \
+                                 BENCH_DWT_CTRL |= 1UL; } while (0)
+#else
+#error "no cycle counter known for this CPU, define BENCH_CYCLES()"
+#endif
+#endif
+
+#ifndef BENCH_CYCLES_INIT
+#define BENCH_CYCLES_INIT() do { } while (0)
+#endif
+
+enum {
+    BENCH_OP_MALLOC,
+    BENCH_OP_FREE,
+    BENCH_OP_REALLOC,
+    BENCH_OP_MEMALIGN,
+    BENCH_OP_COUNT,
+};
+
+/* One step of a trace; slot names the live allocation the step acts on. */
+typedef struct {
+    uint8_t op;
+    uint16_t slot;
+    uint32_t size;
+    uint32_t align;
+} bench_op_t;
+
+#ifdef BENCH_TRACE
+#include BENCH_TRACE
+#endif
+
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint32_t calls;
+    uint32_t failed;
+    uint32_t samples[BENCH_SAMPLES];
+} bench_result_t;
+
+static const char *const op_names[BENCH_OP_COUNT] = {
+    "malloc", "free", "realloc", "memalign",
+};
+
+/* aligned for TLSF_CACHE_LINE_SIZE up to 64 */
+static char heap[BENCH_HEAP_SIZE] __attribute__((aligned(64)));
+static void *slots[BENCH_SLOTS];
+static bench_result_t results[BENCH_OP_COUNT];
+static uint32_t rng_state;
+static uint32_t cycles_overhead;
+static unsigned peak_fragmentation;
+
+static uint32_t rng(void)
+{
+    /* xorshift32, so that every run sees the same trace */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t size_uniform(void)
+{
+    return 1 + rng() % BENCH_MAX_SIZE;
+}
+
+/* Log-uniform sizes: small requests dominate, large ones stay possible. */
+static uint32_t size_power_law(void)
+{
+    uint32_t max = 1;
+    unsigned shift = 0;
+    while ((max << 1) <= BENCH_MAX_SIZE) {
+        max <<= 1;
+        shift++;
+    }
+    /* pick an octave (high / 2, high], so sizes stay within 1..max */
+    uint32_t high = 1UL << (rng() % (shift + 1));
+    return high / 2 + 1 + rng() % (high - high / 2);
+}
+
+static void record(unsigned op, uint32_t cycles, int ok)
+{
+    bench_result_t *res = &results[op];
+
+    cycles = (cycles > cycles_overhead) ? cycles - cycles_overhead : 0;
+    if (!res->calls || cycles < res->min) {
+        res->min = cycles;
+    }
+    if (cycles > res->max) {
+        res->max = cycles;
+    }
+    if (res->calls < BENCH_SAMPLES) {
+        res->samples[res->calls] = cycles;
+    }
+    else {
+        uint32_t i = rng() % (res->calls + 1);
+        if (i < BENCH_SAMPLES) {
+            res->samples[i] = cycles;
+        }
+    }
+    res->calls++;
+    res->failed += !ok;
+}
+
+static void run_op(tlsf_t tlsf, const bench_op_t *op)
+{
+    void **slot = &slots[op->slot % BENCH_SLOTS];
+    void *ptr = NULL;
+    uint32_t start, end;
+
+    switch (op->op) {
+    case BENCH_OP_MALLOC:
+        start = BENCH_CYCLES();
+        ptr = tlsf_malloc_ex(tlsf, op->size);
+        end = BENCH_CYCLES();
+        break;
+    case BENCH_OP_MEMALIGN:
+        start = BENCH_CYCLES();
+        ptr = tlsf_memalign_ex(tlsf, op->align, op->size);
+        end = BENCH_CYCLES();
+        break;
+    case BENCH_OP_REALLOC:
+        start = BENCH_CYCLES();
+        ptr = tlsf_realloc_ex(tlsf, *slot, op->size);
+        end = BENCH_CYCLES();
+        break;
+    case BENCH_OP_FREE:
+        start = BENCH_CYCLES();
+        tlsf_free_ex(tlsf, *slot);
+        end = BENCH_CYCLES();
+        break;
+    default:
+        return;
+    }
+
+    if (op->op == BENCH_OP_FREE) {
+        *slot = NULL;
+        record(op->op, end - start, 1);
+    }
+    else {
+        /* a failed realloc leaves the old block in place */
+        if (ptr || op->op != BENCH_OP_REALLOC) {
+            if (*slot && op->op != BENCH_OP_REALLOC) {
+                tlsf_free_ex(tlsf, *slot);
+            }
+            *slot = ptr;
+        }
+        record(op->op, end - start, ptr != NULL);
+    }
+}
+
+/* Build the next synthetic step: fill empty slots, free or resize full ones. */
+static void next_op(bench_op_t *op, uint32_t (*size)(void), int mixed)
+{
+    op->slot = rng() % BENCH_SLOTS;
+    op->size = size();
+    op->align = 0;
+
+    if (!slots[op->slot]) {
+        if (mixed && rng() % 4 == 0) {
+            op->op = BENCH_OP_MEMALIGN;
+            op->align = 1UL << (3 + rng() % 5);
+        }
+        else {
+            op->op = BENCH_OP_MALLOC;
+        }
+    }
+    else if (mixed && rng() % 3 == 0) {
+        op->op = BENCH_OP_REALLOC;
+    }
+    else {
+        op->op = BENCH_OP_FREE;
+    }
+}
+
+static void sample_fragmentation(tlsf_t tlsf)
+{
+    tlsf_fragmentation_t report;
+    tlsf_fragmentation_report_ex(tlsf, NULL, 0, &report);
+    if (report.fragmentation > peak_fragmentation) {
+        peak_fragmentation = report.fragmentation;
+    }
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name)
+{
+    printf("%s (peak fragmentation %u.%u%%)\n", name,
+           peak_fragmentation / 10, peak_fragmentation % 10);
+    printf("  %-9s %8s %8s %8s %8s %8s %8s\n", "op", "calls", "failed",
+           "min", "median", "p99", "max");
+
+    for (unsigned i = 0; i < BENCH_OP_COUNT; i++) {
+        bench_result_t *res = &results[i];
+        uint32_t n = (res->calls < BENCH_SAMPLES) ? res->calls : BENCH_SAMPLES;
+
+        if (!n) {
+            continue;
+        }
+        qsort(res->samples, n, sizeof(res->samples[0]), compare_u32);
+        printf("  %-9s %8lu %8lu %8lu %8lu %8lu %8lu\n", op_names[i],
+               (unsigned long)res->calls, (unsigned long)res->failed,
+               (unsigned long)res->min, (unsigned long)res->samples[n / 2],
+               (unsigned long)res->samples[(n * 99) / 100],
+               (unsigned long)res->max);
+    }
+}
+
+static tlsf_t setup(void)
+{
+    for (unsigned i = 0; i < BENCH_SLOTS; i++) {
+        slots[i] = NULL;
+    }
+    for (unsigned i = 0; i < BENCH_OP_COUNT; i++) {
+        results[i] = (bench_result_t){ 0 };
+    }
+    peak_fragmentation = 0;
+    rng_state = 0x2545f491;
+
+    tlsf_t tlsf = tlsf_create_with_pool(heap, sizeof(heap));
+    if (!tlsf) {
+        printf("cannot create a heap of %u bytes\n", (unsigned)BENCH_HEAP_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    return tlsf;
+}
+
+static void run_synthetic(const char *name, uint32_t (*size)(void), int mixed)
+{
+    tlsf_t tlsf = setup();
+    bench_op_t op;
+
+    for (unsigned step = 0; step < BENCH_STEPS; step++) {
+        next_op(&op, size, mixed);
+        run_op(tlsf, &op);
+        if (step % BENCH_FRAG_PERIOD == 0) {
+            sample_fragmentation(tlsf);
+        }
+    }
+    report(name);
+    tlsf_destroy(tlsf);
+}
+
+#ifdef BENCH_TRACE
+static void run_trace(void)
+{
+    tlsf_t tlsf = setup();
+    size_t count = sizeof(bench_trace) / sizeof(bench_trace[0]);
+
+    for (size_t step = 0; step < count; step++) {
+        run_op(tlsf, &bench_trace[step]);
+        if (step % BENCH_FRAG_PERIOD == 0) {
+            sample_fragmentation(tlsf);
+        }
+    }
+    report("recorded");
+    tlsf_destroy(tlsf);
+}
+#endif
+
+int main(void)
+{
+    BENCH_CYCLES_INIT();
+
+    /* calibrate the cost of reading the counter itself */
+    cycles_overhead = UINT32_MAX;
+    for (unsigned i = 0; i < 16; i++) {
+        uint32_t start = BENCH_CYCLES();
+        uint32_t end = BENCH_CYCLES();
+        if (end - start < cycles_overhead) {
+            cycles_overhead = end - start;
+        }
+    }
+
+    printf("TLSF benchmark: heap %u bytes, %u slots, sizes up to %u\n",
+           (unsigned)BENCH_HEAP_SIZE, (unsigned)BENCH_SLOTS,
+           (unsigned)BENCH_MAX_SIZE);
+
+    run_synthetic("uniform", size_uniform, 0);
+    run_synthetic("power-law", size_power_law, 0);
+    run_synthetic("mixed", size_uniform, 1);
+#ifdef BENCH_TRACE
+    run_trace();
+#endif
+    return 0;
+}
@@ -0,0 +1,450 @@
+/*
+ * Single-threaded API tests for the TLSF core and the modules around it.
+ *
+ * Each test sets up its own instance in a static buffer and reports every
+ * failed expectation; the program exits non-zero if any test failed.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tlsf-arena.h"
+#include "tlsf-handle.h"
+#include "tlsf-malloc.h"
+
+#ifndef API_HEAP_SIZE
+#define API_HEAP_SIZE       (64 * 1024)
+#endif
+
+/* aligned for TLSF_CACHE_LINE_SIZE up to 64 */
+static char memory[2][API_HEAP_SIZE] __attribute__((aligned(64)));
+static unsigned failures;
+
+#define expect(cond) expect_at((cond), #cond, __func__, __LINE__)
+
+static void expect_at(int ok, const char *what, const char *test, int line)
+{
+    if (!ok) {
+        printf("api: %s:%d: expected %s\n", test, line, what);
+        failures++;
+    }
+}
+
+/* The first instance created is the default until it is destroyed. */
+static void test_default_instance(void)
+{
+    tlsf_t first = tlsf_create_with_pool(memory[0], API_HEAP_SIZE);
+    tlsf_t second = tlsf_create_with_pool(memory[1], API_HEAP_SIZE);
+
+    expect(first && second);
+    expect(tlsf_get_default() == first);
+
+    tlsf_destroy(second);
+    expect(tlsf_get_default() == first);
+    tlsf_destroy(first);
+    expect(tlsf_get_default() == NULL);
+
+    second = tlsf_create_with_pool(memory[1], API_HEAP_SIZE);
+    expect(tlsf_get_default() == second);
+    void *ptr = tlsf_malloc(100);
+    expect(ptr >= (void *)memory[1] && ptr < (void *)(memory[1] + API_HEAP_SIZE));
+    tlsf_free(ptr);
+    tlsf_destroy(second);
+}
+
+static unsigned errors;
+
+static void count_error(const char *format, va_list args)
+{
+    (void)format;
+    (void)args;
+    errors++;
+}
+
+static void print_error(const char *format, va_list args)
+{
+    vprintf(format, args);
+}
+
+/* Memory that cannot hold an instance and a pool is reported, not used. */
+static void test_create_failures(void)
+{
+    tlsf_set_error_handler(count_error);
+    errors = 0;
+    expect(!tlsf_create_with_pool(memory[0] + 1, API_HEAP_SIZE - 1));
+    expect(!tlsf_create_with_pool(memory[0], tlsf_size() / 2));
+    expect(!tlsf_create_with_pool(memory[0], tlsf_size() + 1));
+    expect(errors == 3);
+    expect(tlsf_get_default() == NULL);
+    tlsf_set_error_handler(print_error);
+}
+
+/*
+** Heap results are aligned like core blocks, also those of the slab
+** front-end, which the api-slab target builds with 16-byte alignment.
+*/
+static void test_heap_alignment(void)
+{
+    tlsf_heap_t heap;
+    void *ptrs[64];
+
+    tlsf_heap_init(&heap, tlsf_create_with_pool(memory[0], API_HEAP_SIZE));
+    for (size_t bytes = 1; bytes <= 128; bytes++) {
+        for (unsigned i = 0; i < 64; i++) {
+            ptrs[i] = tlsf_heap_malloc(&heap, bytes);
+            expect(ptrs[i] && (uintptr_t)ptrs[i] % tlsf_align_size() == 0);
+        }
+        for (unsigned i = 0; i < 64; i++) {
+            tlsf_heap_free(&heap, ptrs[i]);
+        }
+    }
+    expect(tlsf_heap_check(&heap) == 0);
+    tlsf_destroy(heap.tlsf);
+}
+
+static int all_zero(const void *ptr, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        if (((const unsigned char *)ptr)[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+** calloc returns zeroed memory from a zeroed pool, from its clean part as
+** well as from blocks that were dirtied, freed and merged again, and from
+** an ordinary pool full of garbage. tlsf_heap_calloc clears outside the
+** heap lock and must agree.
+*/
+static void calloc_rounds(tlsf_t tlsf)
+{
+    void *ptrs[32];
+    tlsf_heap_t heap;
+
+    tlsf_heap_init(&heap, tlsf);
+    for (unsigned round = 0; round < 8; round++) {
+        for (unsigned i = 0; i < 32; i++) {
+            size_t bytes = 1 + (i * 397 + round * 131) % 1500;
+            ptrs[i] = (i + round) % 2 ? tlsf_calloc_ex(tlsf, 1, bytes)
+                                      : tlsf_heap_calloc(&heap, bytes, 1);
+            expect(ptrs[i] && all_zero(ptrs[i], bytes));
+            /* dirty the whole capacity, so that reuse sees garbage */
+            memset(ptrs[i], 0x5a, tlsf_usable_size(ptrs[i]));
+        }
+        /* free every other block first, the rest later merges around them */
+        for (unsigned i = 0; i < 32; i += 2) {
+            tlsf_free_ex(tlsf, ptrs[i]);
+        }
+        for (unsigned i = 1; i < 32; i += 2) {
+            tlsf_free_ex(tlsf, ptrs[i]);
+        }
+    }
+
+    /* one block spanning dirtied and clean memory */
+    tlsf_coalesce_ex(tlsf);
+    void *big = tlsf_calloc_ex(tlsf, 1, API_HEAP_SIZE / 2);
+    expect(big && all_zero(big, API_HEAP_SIZE / 2));
+    tlsf_free_ex(tlsf, big);
+    expect(tlsf_check_ex(tlsf) == 0);
+}
+
+static void test_calloc_reuse(void)
+{
+    tlsf_t tlsf = tlsf_create(memory[0]);
+
+    memset(memory[1], 0, API_HEAP_SIZE);
+    expect(tlsf_add_zeroed_pool_ex(tlsf, memory[1], API_HEAP_SIZE) != NULL);
+    calloc_rounds(tlsf);
+    tlsf_destroy(tlsf);
+
+    memset(memory[1], 0xa5, API_HEAP_SIZE);
+    tlsf = tlsf_create(memory[0]);
+    expect(tlsf_add_pool_ex(tlsf, memory[1], API_HEAP_SIZE) != NULL);
+    calloc_rounds(tlsf);
+    tlsf_destroy(tlsf);
+}
+
+static tlsf_fragmentation_t heap_report(tlsf_heap_t *heap)
+{
+    tlsf_fragmentation_t report;
+
+    tlsf_coalesce_ex(heap->tlsf);
+    tlsf_heap_fragmentation_report(heap, NULL, 0, &report);
+    return report;
+}
+
+/*
+** Arena objects are aligned and do not overlap, releasing to a mark and
+** resetting drop the chunks chained since, and destroying the arena
+** leaves the heap as one free block of the size it had before.
+*/
+static void test_arena(void)
+{
+    unsigned char *objects[200];
+    tlsf_arena_t arena;
+    tlsf_heap_t heap;
+
+    tlsf_heap_init(&heap, tlsf_create_with_pool(memory[0], API_HEAP_SIZE));
+    tlsf_fragmentation_t before = heap_report(&heap);
+
+    expect(tlsf_arena_init(&arena, &heap, 1024, 512));
+    for (unsigned i = 0; i < 200; i++) {
+        size_t bytes = 1 + i % 61;
+        objects[i] = tlsf_arena_alloc(&arena, bytes);
+        expect(objects[i] && (uintptr_t)objects[i] % TLSF_ARENA_ALIGN == 0);
+        memset(objects[i], i, bytes);
+        if (i == 99) {
+            tlsf_arena_mark_t mark = tlsf_arena_mark(&arena);
+            void *aligned = tlsf_arena_memalign(&arena, 256, 700);
+            expect(aligned && (uintptr_t)aligned % 256 == 0);
+            tlsf_arena_release(&arena, mark);
+            expect(arena.chunk == mark.chunk && arena.pos == mark.pos);
+        }
+    }
+    for (unsigned i = 0; i < 200; i++) {
+        for (size_t j = 0; j < 1 + i % 61; j++) {
+            expect(objects[i][j] == (unsigned char)i);
+        }
+    }
+    expect(arena.chunk->prev != NULL);
+    expect(heap_report(&heap).free_bytes < before.free_bytes);
+
+    /* a reset keeps only the first chunk, and objects start over */
+    tlsf_arena_reset(&arena);
+    expect(arena.chunk->prev == NULL);
+    expect(tlsf_arena_alloc(&arena, 1) == objects[0]);
+
+    tlsf_arena_destroy(&arena);
+    tlsf_fragmentation_t after = heap_report(&heap);
+    expect(arena.chunk == NULL);
+    expect(after.free_blocks == 1 && after.free_bytes == before.free_bytes);
+    expect(tlsf_heap_check(&heap) == 0);
+    tlsf_destroy(heap.tlsf);
+}
+
+/*
+** A tag never goes over its budget, counting blocks at the size that free
+** credits back: a free block too small to split is handed out whole.
+*/
+static void test_tag_budget(void)
+{
+    tlsf_t tlsf = tlsf_create_with_pool(memory[0], API_HEAP_SIZE);
+    const size_t budget = 4096;
+    void *ptrs[64] = { NULL };
+
+    if (tlsf_tag_count() < 2) {
+        tlsf_destroy(tlsf);
+        return;
+    }
+
+    /* a 40-byte hole, which a 32-byte request takes without a split */
+    void *before = tlsf_malloc_ex(tlsf, 64);
+    void *hole = tlsf_malloc_ex(tlsf, 40);
+    void *after = tlsf_malloc_ex(tlsf, 64);
+    size_t hole_size = tlsf_block_size(hole);
+    tlsf_free_ex(tlsf, hole);
+    tlsf_coalesce_ex(tlsf);
+
+    tlsf_set_tag_budget_ex(tlsf, 1, 32 + tlsf_alloc_overhead());
+    void *ptr = tlsf_malloc_tagged_ex(tlsf, 1, 32);
+    expect(tlsf_tag_used_ex(tlsf, 1) <= 32 + tlsf_alloc_overhead());
+    expect(!ptr || tlsf_block_size(ptr) < hole_size);
+    tlsf_free_ex(tlsf, ptr);
+    tlsf_free_ex(tlsf, before);
+    tlsf_free_ex(tlsf, after);
+
+    /* allocations, reallocs and resizes up to the budget */
+    tlsf_set_tag_budget_ex(tlsf, 1, budget);
+    for (unsigned step = 0; step < 2000; step++) {
+        unsigned i = (step * 7) % 64;
+        size_t bytes = 1 + (step * 53) % 300;
+        switch (step % 3) {
+        case 0:
+            tlsf_free_ex(tlsf, ptrs[i]);
+            ptrs[i] = tlsf_malloc_tagged_ex(tlsf, 1, bytes);
+            break;
+        default:
+            ptr = !ptrs[i] ? NULL : step % 3 == 1
+                ? tlsf_realloc_ex(tlsf, ptrs[i], bytes)
+                : tlsf_resize_move_ex(tlsf, ptrs[i], bytes);
+            if (ptr) {
+                ptrs[i] = ptr;
+            }
+            break;
+        }
+        expect(tlsf_tag_used_ex(tlsf, 1) <= budget);
+    }
+    for (unsigned i = 0; i < 64; i++) {
+        tlsf_free_ex(tlsf, ptrs[i]);
+    }
+    expect(tlsf_tag_used_ex(tlsf, 1) == 0);
+    tlsf_destroy(tlsf);
+}
+
+#ifdef TLSF_REMOTE_FREE
+/* Blocks queued by tlsf_free_remote count as free to pool removal. */
+static void test_remote_free(void)
+{
+    tlsf_t tlsf = tlsf_create(memory[0]);
+    pool_t pool = tlsf_add_pool_ex(tlsf, memory[1], API_HEAP_SIZE);
+    tlsf_fragmentation_t before, after;
+
+    tlsf_fragmentation_report_ex(tlsf, NULL, 0, &before);
+    void *ptr = tlsf_malloc_ex(tlsf, 100);
+    expect(ptr != NULL);
+    tlsf_free_remote_ex(tlsf, ptr);
+    tlsf_coalesce_ex(tlsf);
+    tlsf_fragmentation_report_ex(tlsf, NULL, 0, &after);
+    expect(after.free_bytes == before.free_bytes && after.free_blocks == 1);
+
+    ptr = tlsf_malloc_ex(tlsf, 100);
+    tlsf_free_remote_ex(tlsf, ptr);
+    expect(tlsf_remove_pool_ex(tlsf, pool));
+    expect(tlsf_malloc_ex(tlsf, 1) == NULL);
+    tlsf_destroy(tlsf);
+}
+#endif
+
+#ifdef TLSF_STATS
+/* A request refused for its whole-block charge leaves the stats alone. */
+static void test_tag_budget_peak(void)
+{
+    tlsf_t tlsf = tlsf_create_with_pool(memory[0], API_HEAP_SIZE);
+    void *fill[64];
+    unsigned count = 0;
+    tlsf_stats_t before, after;
+
+    if (tlsf_tag_count() < 2) {
+        tlsf_destroy(tlsf);
+        return;
+    }
+
+    /* fill the heap, so that used reaches the peak */
+    for (size_t bytes = API_HEAP_SIZE; bytes && count < 64;) {
+        void *ptr = tlsf_malloc_ex(tlsf, bytes);
+        if (ptr) {
+            fill[count++] = ptr;
+        } else {
+            bytes /= 2;
+        }
+    }
+    expect(count < 64);
+
+    /* a 40-byte pool is the only free block, never handed out before */
+    pool_t pool = tlsf_add_pool_ex(tlsf, memory[1], tlsf_pool_overhead() + 40);
+    expect(pool != NULL);
+
+    tlsf_set_tag_budget_ex(tlsf, 1, 32 + tlsf_alloc_overhead());
+    tlsf_get_stats_ex(tlsf, &before);
+    void *ptr = tlsf_malloc_tagged_ex(tlsf, 1, 32);
+    tlsf_get_stats_ex(tlsf, &after);
+    expect(!ptr);
+    expect(after.peak == before.peak);
+    expect(after.used == before.used && after.count == before.count);
+    expect(tlsf_tag_used_ex(tlsf, 1) == 0);
+
+    /* the block is still free for an untagged request */
+    ptr = tlsf_malloc_ex(tlsf, 32);
+    expect(ptr != NULL);
+    tlsf_free_ex(tlsf, ptr);
+    while (count) {
+        tlsf_free_ex(tlsf, fill[--count]);
+    }
+    expect(tlsf_check_ex(tlsf) == 0);
+    tlsf_destroy(tlsf);
+}
+#endif
+
+static void fill_handle(tlsf_handles_t *table, tlsf_handle_t handle,
+                        size_t bytes)
+{
+    memset(tlsf_hlock(table, handle), (int)handle, bytes);
+    tlsf_hunlock(table, handle);
+}
+
+static int handle_intact(tlsf_handles_t *table, tlsf_handle_t handle,
+                         size_t bytes)
+{
+    const unsigned char *ptr = tlsf_hlock(table, handle);
+    size_t i = 0;
+
+    while (ptr && i < bytes && ptr[i] == (unsigned char)handle) {
+        i++;
+    }
+    tlsf_hunlock(table, handle);
+    return ptr && i == bytes;
+}
+
+/*
+** Compaction moves unlocked allocations down with their contents, leaves
+** locked ones in place, and merges the holes between them into the free
+** space before the locked one and the free space at the end.
+*/
+static void test_handle_compaction(void)
+{
+    tlsf_handle_t handles[TLSF_HANDLE_COUNT];
+    size_t sizes[TLSF_HANDLE_COUNT];
+    tlsf_handles_t table;
+    tlsf_heap_t heap;
+    unsigned steps = 0;
+
+    tlsf_heap_init(&heap, tlsf_create_with_pool(memory[0], API_HEAP_SIZE));
+    tlsf_handles_init(&table, &heap);
+    for (unsigned i = 0; i < TLSF_HANDLE_COUNT; i++) {
+        sizes[i] = 16 + (i * 173) % 700;
+        handles[i] = tlsf_halloc(&table, sizes[i]);
+        expect(handles[i] != 0);
+        fill_handle(&table, handles[i], sizes[i]);
+    }
+    for (unsigned i = 0; i < TLSF_HANDLE_COUNT; i += 2) {
+        tlsf_hfree(&table, handles[i]);
+        handles[i] = 0;
+    }
+
+    unsigned pinned = TLSF_HANDLE_COUNT / 2 + 1;
+    void *pinned_ptr = tlsf_hlock(&table, handles[pinned]);
+
+    expect(heap_report(&heap).free_blocks > 2);
+    while (!tlsf_compact(&table, 0) && steps++ < 100 * TLSF_HANDLE_COUNT) {
+    }
+    expect(steps < 100 * TLSF_HANDLE_COUNT);
+
+    expect(tlsf_hlock(&table, handles[pinned]) == pinned_ptr);
+    tlsf_hunlock(&table, handles[pinned]);
+    tlsf_hunlock(&table, handles[pinned]);
+    for (unsigned i = 1; i < TLSF_HANDLE_COUNT; i += 2) {
+        expect(handle_intact(&table, handles[i], sizes[i]));
+    }
+    expect(heap_report(&heap).free_blocks <= 2);
+    expect(tlsf_heap_check(&heap) == 0);
+
+    for (unsigned i = 1; i < TLSF_HANDLE_COUNT; i += 2) {
+        tlsf_hfree(&table, handles[i]);
+    }
+    expect(heap_report(&heap).free_blocks == 1);
+    tlsf_destroy(heap.tlsf);
+}
+
+int main(void)
+{
+    test_default_instance();
+    test_create_failures();
+    test_heap_alignment();
+    test_calloc_reuse();
+    test_arena();
+    test_tag_budget();
+#ifdef TLSF_REMOTE_FREE
+    test_remote_free();
+#endif
+#ifdef TLSF_STATS
+    test_tag_budget_peak();
+#endif
+    test_handle_compaction();
+
+    printf("api: %u failures\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * Cache ids for host threads, forced into every file of the stress-cache
+ * build with -include. Each stress thread sets its own id, other threads
+ * keep -1 and bypass the cache.
+ */
+
+#ifndef HOST_CACHE_ID_H
+#define HOST_CACHE_ID_H
+
+extern _Thread_local int host_cache_id;
+
+#define TLSF_MALLOC_CACHE_ID()      (host_cache_id)
+#define TLSF_MALLOC_CACHE_COUNT     (8)
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Tests for the C++ adapters in tlsf.hpp, built with -std=c++17 so that
+ * tlsf::memory_resource is covered as well.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "tlsf.hpp"
+
+#ifndef CXX_HEAP_SIZE
+#define CXX_HEAP_SIZE       (64 * 1024)
+#endif
+
+/* aligned for TLSF_CACHE_LINE_SIZE up to 64 */
+alignas(64) static char memory[CXX_HEAP_SIZE];
+static tlsf_heap_t heap;
+static unsigned failures;
+
+#define expect(cond) expect_at((cond), #cond, __func__, __LINE__)
+
+static void expect_at(bool ok, const char *what, const char *test, int line)
+{
+    if (!ok) {
+        std::printf("cxx: %s:%d: expected %s\n", test, line, what);
+        failures++;
+    }
+}
+
+static void test_allocator()
+{
+    tlsf::allocator<int> alloc(&heap);
+    std::vector<int, tlsf::allocator<int>> v(alloc);
+    for (int i = 0; i < 1000; i++) {
+        v.push_back(i);
+    }
+    expect(v[999] == 999);
+
+    /* allocate(0) hands out a pointer that deallocate takes back */
+    int *a = alloc.allocate(0);
+    int *b = alloc.allocate(0);
+    expect(a && b && a != b);
+    alloc.deallocate(a, 0);
+    alloc.deallocate(b, 0);
+}
+
+#ifdef TLSF_HAVE_MEMORY_RESOURCE
+static void test_memory_resource()
+{
+    tlsf::memory_resource res(&heap);
+    std::pmr::vector<int> v(&res);
+    for (int i = 0; i < 1000; i++) {
+        v.push_back(i);
+    }
+    expect(v[999] == 999);
+
+    void *a = res.allocate(0);
+    void *b = res.allocate(0, 64);
+    expect(a && b && a != b);
+    expect(reinterpret_cast<std::uintptr_t>(b) % 64 == 0);
+    res.deallocate(a, 0);
+    res.deallocate(b, 0, 64);
+
+    tlsf::memory_resource other(&heap);
+    expect(res.is_equal(other));
+}
+#endif
+
+int main()
+{
+    tlsf_heap_init(&heap, tlsf_create_with_pool(memory, sizeof(memory)));
+
+    test_allocator();
+#ifdef TLSF_HAVE_MEMORY_RESOURCE
+    test_memory_resource();
+#endif
+    expect(tlsf_heap_check(&heap) == 0);
+    tlsf_destroy(heap.tlsf);
+
+    std::printf("cxx: %u failures\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * libFuzzer harness for the TLSF core.
+ *
+ * Each input is a program of allocator calls on a fresh instance: every
+ * operation is an opcode byte followed by a slot byte and two size bytes.
+ * After each call tlsf_check_ex() and tlsf_check_pool() must pass and
+ * every live block must still hold the pattern it was filled with, so any
+ * corruption is caught at the call that caused it.
+ *
+ *     make -C host fuzz CC=clang
+ *     host/fuzz -max_total_time=60 corpus/
+ *
+ * Built with FUZZ_STANDALONE (the fuzz-smoke target), main() runs the
+ * files given on the command line, or FUZZ_RUNS random inputs without
+ * arguments, so that compilers without libFuzzer can use the harness too.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlsf.h"
+
+#ifndef FUZZ_HEAP_SIZE
+#define FUZZ_HEAP_SIZE      (64 * 1024)
+#endif
+
+#ifndef FUZZ_SLOTS
+#define FUZZ_SLOTS          (32)
+#endif
+
+#ifndef FUZZ_RUNS
+#define FUZZ_RUNS           (500)
+#endif
+
+enum {
+    FUZZ_MALLOC,
+    FUZZ_CALLOC,
+    FUZZ_MEMALIGN,
+    FUZZ_BEST_FIT,
+    FUZZ_AT_LEAST,
+    FUZZ_REALLOC,
+    FUZZ_RESIZE,
+    FUZZ_RESIZE_MOVE,
+    FUZZ_TRY_EXPAND,
+    FUZZ_MOVE_DOWN,
+    FUZZ_FREE,
+    FUZZ_FREE_SIZED,
+    FUZZ_MALLOC_BATCH,
+    FUZZ_FREE_BATCH,
+    FUZZ_COALESCE,
+    FUZZ_OP_COUNT,
+};
+
+typedef struct {
+    unsigned char *ptr;
+    size_t size;
+    unsigned char fill;
+} fuzz_slot_t;
+
+/* aligned for TLSF_CACHE_LINE_SIZE up to 64 */
+static char memory[FUZZ_HEAP_SIZE] __attribute__((aligned(64)));
+static fuzz_slot_t slots[FUZZ_SLOTS];
+
+static void set(fuzz_slot_t *slot, void *ptr, size_t size, unsigned char fill)
+{
+    slot->ptr = ptr;
+    slot->size = ptr ? size : 0;
+    slot->fill = fill;
+    if (ptr) {
+        memset(ptr, fill, size);
+    }
+}
+
+/* The first size bytes of a resized block keep their fill. */
+static void keep(fuzz_slot_t *slot, void *ptr, size_t size)
+{
+    for (size_t i = 0; ptr && i < size && i < slot->size; i++) {
+        if (((unsigned char *)ptr)[i] != slot->fill) {
+            abort();
+        }
+    }
+}
+
+static void check(tlsf_t tlsf)
+{
+    if (tlsf_check_ex(tlsf) || tlsf_check_pool(tlsf_get_pool(tlsf))) {
+        abort();
+    }
+    for (unsigned i = 0; i < FUZZ_SLOTS; i++) {
+        if (slots[i].ptr && tlsf_usable_size(slots[i].ptr) < slots[i].size) {
+            abort();
+        }
+        keep(&slots[i], slots[i].ptr, slots[i].size);
+    }
+}
+
+static void run(tlsf_t tlsf, const uint8_t *op)
+{
+    fuzz_slot_t *slot = &slots[op[1] % FUZZ_SLOTS];
+    size_t size = op[2] | ((size_t)op[3] << 8);
+    unsigned char fill = op[1] ^ op[2];
+    void *ptr;
+
+    switch (op[0] % FUZZ_OP_COUNT) {
+    case FUZZ_MALLOC:
+    case FUZZ_CALLOC:
+    case FUZZ_MEMALIGN:
+    case FUZZ_BEST_FIT:
+    case FUZZ_AT_LEAST:
+        tlsf_free_ex(tlsf, slot->ptr);
+        if (op[0] % FUZZ_OP_COUNT == FUZZ_CALLOC) {
+            ptr = tlsf_calloc_ex(tlsf, 1, size);
+            for (size_t i = 0; ptr && i < size; i++) {
+                if (((unsigned char *)ptr)[i]) {
+                    abort();
+                }
+            }
+        }
+        else if (op[0] % FUZZ_OP_COUNT == FUZZ_MEMALIGN) {
+            size_t align = (size_t)1 << (op[3] % 12);
+            ptr = tlsf_memalign_ex(tlsf, align, size & 0xff);
+            if (ptr && (uintptr_t)ptr % align) {
+                abort();
+            }
+            size &= 0xff;
+        }
+        else if (op[0] % FUZZ_OP_COUNT == FUZZ_AT_LEAST) {
+            /* the whole capacity belongs to the caller and gets filled */
+            size_t actual;
+            ptr = tlsf_malloc_at_least_ex(tlsf, size, &actual);
+            if (ptr ? actual < size || actual != tlsf_usable_size(ptr) : actual) {
+                abort();
+            }
+            size = actual;
+        }
+        else {
+            ptr = tlsf_malloc_flags_ex(tlsf, size,
+                op[0] % FUZZ_OP_COUNT == FUZZ_BEST_FIT ? TLSF_BEST_FIT : 0);
+        }
+        set(slot, ptr, size, fill);
+        break;
+    case FUZZ_REALLOC:
+        ptr = tlsf_realloc_ex(tlsf, slot->ptr, size);
+        if (ptr || !size) {
+            keep(slot, ptr, size);
+            set(slot, ptr, size, fill);
+        }
+        break;
+    case FUZZ_RESIZE:
+    case FUZZ_RESIZE_MOVE:
+        if (slot->ptr && size) {
+            ptr = op[0] % FUZZ_OP_COUNT == FUZZ_RESIZE
+                ? tlsf_resize_ex(tlsf, slot->ptr, size)
+                : tlsf_resize_move_ex(tlsf, slot->ptr, size);
+            if (ptr) {
+                keep(slot, ptr, size);
+                set(slot, ptr, size, fill);
+            }
+        }
+        break;
+    case FUZZ_TRY_EXPAND:
+        if (slot->ptr && tlsf_try_expand_ex(tlsf, slot->ptr, size)) {
+            set(slot, slot->ptr, size > slot->size ? size : slot->size, slot->fill);
+        }
+        break;
+    case FUZZ_MOVE_DOWN:
+        if (slot->ptr && (ptr = tlsf_move_down_ex(tlsf, slot->ptr))) {
+            keep(slot, ptr, slot->size);
+            slot->ptr = ptr;
+        }
+        break;
+    case FUZZ_FREE:
+        tlsf_free_ex(tlsf, slot->ptr);
+        set(slot, NULL, 0, 0);
+        break;
+    case FUZZ_FREE_SIZED:
+        tlsf_free_sized_ex(tlsf, slot->ptr, slot->size);
+        set(slot, NULL, 0, 0);
+        break;
+    case FUZZ_MALLOC_BATCH: {
+        /* fill the empty slots from op[1] on with blocks of one size */
+        void *ptrs[FUZZ_SLOTS];
+        size_t count = tlsf_malloc_batch_ex(tlsf, size & 0x3ff, op[2] % 8, ptrs);
+        for (unsigned i = op[1]; count && i < op[1] + (unsigned)FUZZ_SLOTS; i++) {
+            if (!slots[i % FUZZ_SLOTS].ptr) {
+                set(&slots[i % FUZZ_SLOTS], ptrs[--count], size & 0x3ff, fill);
+            }
+        }
+        while (count) {
+            tlsf_free_ex(tlsf, ptrs[--count]);
+        }
+        break;
+    }
+    case FUZZ_FREE_BATCH: {
+        /* free the slots whose bit is set in the size bytes */
+        void *ptrs[16];
+        size_t count = 0;
+        for (unsigned i = 0; i < 16; i++) {
+            if (size & (1u << i)) {
+                ptrs[count++] = slots[(op[1] + i) % FUZZ_SLOTS].ptr;
+                set(&slots[(op[1] + i) % FUZZ_SLOTS], NULL, 0, 0);
+            }
+        }
+        tlsf_free_batch_ex(tlsf, ptrs, count);
+        break;
+    }
+    default:
+        tlsf_coalesce_ex(tlsf);
+        break;
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    tlsf_t tlsf = tlsf_create_with_pool(memory, sizeof(memory));
+
+    memset(slots, 0, sizeof(slots));
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        run(tlsf, data + i);
+        check(tlsf);
+    }
+
+    /* a fully freed heap is one free block again */
+    for (unsigned i = 0; i < FUZZ_SLOTS; i++) {
+        tlsf_free_ex(tlsf, slots[i].ptr);
+    }
+    tlsf_coalesce_ex(tlsf);
+    if (!tlsf_malloc_ex(tlsf, FUZZ_HEAP_SIZE / 2)) {
+        abort();
+    }
+    tlsf_destroy(tlsf);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static void run_file(const char *name)
+{
+    static uint8_t data[1 << 16];
+    FILE *file = fopen(name, "rb");
+    size_t size;
+
+    if (!file) {
+        perror(name);
+        exit(1);
+    }
+    size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+    LLVMFuzzerTestOneInput(data, size);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t data[1024];
+    uint32_t state = 1;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            run_file(argv[i]);
+        }
+        return 0;
+    }
+
+    for (unsigned run = 0; run < FUZZ_RUNS; run++) {
+        size_t size = 4 + state % (sizeof(data) - 4);
+        for (size_t i = 0; i < size; i++) {
+            /* xorshift32, so that every run sees the same inputs */
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            data[i] = (uint8_t)state;
+        }
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("fuzz: %u random inputs passed\n", FUZZ_RUNS);
+    return 0;
+}
+#endif
@@ -0,0 +1,280 @@
+/*
+ * Multi-threaded stress test for the TLSF heap layer on the host.
+ *
+ * STRESS_THREADS threads allocate, resize and free blocks of random sizes
+ * on one tlsf_heap_t locked with TLSF_MALLOC_LOCK_PTHREAD, and pass blocks
+ * to each other through a shared table so that blocks are freed by other
+ * threads than the one that allocated them. Every block carries its size
+ * and a fill pattern that is verified before it is resized or freed, and
+ * thread 0 runs tlsf_heap_check() every STRESS_CHECK_PERIOD steps. At
+ * the end all blocks are freed and the heap must be one free block again.
+ *
+ * Build options:
+ *   STRESS_THREADS       number of threads
+ *   STRESS_STEPS         operations per thread
+ *   STRESS_SLOTS         live blocks per thread
+ *   STRESS_SHARED        slots of the table shared by all threads
+ *   STRESS_HEAP_SIZE     heap size in bytes
+ *   STRESS_MAX_SIZE      largest request size
+ *   STRESS_CHECK_PERIOD  steps between heap checks
+ *
+ * The stress-cache target builds it with TLSF_MALLOC_CACHE and the thread
+ * ids of cache-id.h; each thread flushes its magazines before it exits.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlsf-malloc.h"
+
+#ifndef STRESS_THREADS
+#define STRESS_THREADS      (4)
+#endif
+
+#ifndef STRESS_STEPS
+#define STRESS_STEPS        (200000)
+#endif
+
+#ifndef STRESS_SLOTS
+#define STRESS_SLOTS        (128)
+#endif
+
+#ifndef STRESS_SHARED
+#define STRESS_SHARED       (64)
+#endif
+
+#ifndef STRESS_HEAP_SIZE
+#define STRESS_HEAP_SIZE    (4 * 1024 * 1024)
+#endif
+
+#ifndef STRESS_MAX_SIZE
+#define STRESS_MAX_SIZE     (4096)
+#endif
+
+#ifndef STRESS_CHECK_PERIOD
+#define STRESS_CHECK_PERIOD (1000)
+#endif
+
+typedef struct {
+    unsigned id;
+    uint32_t rng_state;
+    void *slots[STRESS_SLOTS];
+} stress_thread_t;
+
+/* aligned for TLSF_CACHE_LINE_SIZE up to 64 */
+static char memory[STRESS_HEAP_SIZE] __attribute__((aligned(64)));
+static tlsf_heap_t heap;
+static void *_Atomic shared[STRESS_SHARED];
+static atomic_uint failures;
+
+#ifdef TLSF_MALLOC_CACHE
+_Thread_local int host_cache_id = -1;
+#endif
+
+static uint32_t rng(stress_thread_t *thread)
+{
+    /* xorshift32, seeded per thread */
+    thread->rng_state ^= thread->rng_state << 13;
+    thread->rng_state ^= thread->rng_state >> 17;
+    thread->rng_state ^= thread->rng_state << 5;
+    return thread->rng_state;
+}
+
+/* Mostly small sizes, some up to STRESS_MAX_SIZE; at least a size_t. */
+static size_t random_size(stress_thread_t *thread)
+{
+    size_t max = (rng(thread) % 8) ? 128 : STRESS_MAX_SIZE;
+    return sizeof(size_t) + rng(thread) % max;
+}
+
+static unsigned char fill_byte(size_t bytes)
+{
+    return (unsigned char)(bytes * 131 + 7);
+}
+
+/* A block starts with its size, the rest holds a pattern derived from it. */
+static void fill(void *ptr, size_t bytes)
+{
+    memcpy(ptr, &bytes, sizeof(bytes));
+    memset((char *)ptr + sizeof(bytes), fill_byte(bytes), bytes - sizeof(bytes));
+}
+
+static void fail(const char *what, void *ptr)
+{
+    printf("stress: %s at %p\n", what, ptr);
+    atomic_fetch_add(&failures, 1);
+}
+
+/* Return the size of a block, or 0 if its pattern was damaged. */
+static size_t verify(void *ptr)
+{
+    const unsigned char *bytes = ptr;
+    size_t size;
+
+    memcpy(&size, ptr, sizeof(size));
+    if (size < sizeof(size) || size > STRESS_MAX_SIZE + sizeof(size)
+        || tlsf_heap_usable_size(&heap, ptr) < size) {
+        fail("bad size", ptr);
+        return 0;
+    }
+    for (size_t i = sizeof(size); i < size; i++) {
+        if (bytes[i] != fill_byte(size)) {
+            fail("damaged block", ptr);
+            return 0;
+        }
+    }
+    return size;
+}
+
+/* Every other size is passed back as a hint. */
+static void release(void *ptr)
+{
+    size_t size = ptr ? verify(ptr) : 0;
+
+    if (size % 2) {
+        tlsf_heap_free_sized(&heap, ptr, size);
+    }
+    else if (size) {
+        tlsf_heap_free(&heap, ptr);
+    }
+}
+
+static void *allocate(stress_thread_t *thread)
+{
+    size_t bytes = random_size(thread);
+    void *ptr;
+
+    switch (rng(thread) % 4) {
+    case 0:
+        ptr = tlsf_heap_calloc(&heap, 1, bytes);
+        for (size_t i = 0; ptr && i < bytes; i++) {
+            if (((unsigned char *)ptr)[i]) {
+                fail("calloc not cleared", ptr);
+                break;
+            }
+        }
+        break;
+    case 1:
+        ptr = tlsf_heap_memalign(&heap, (size_t)8 << (rng(thread) % 6), bytes);
+        break;
+    default:
+        ptr = tlsf_heap_malloc(&heap, bytes);
+        break;
+    }
+    if (ptr) {
+        fill(ptr, bytes);
+    }
+    return ptr;
+}
+
+static void step(stress_thread_t *thread)
+{
+    unsigned index = rng(thread) % STRESS_SLOTS;
+    void *ptr = thread->slots[index];
+
+    if (!ptr) {
+        thread->slots[index] = allocate(thread);
+        return;
+    }
+
+    switch (rng(thread) % 4) {
+    case 0: {
+        /* keep the old size and pattern in front of the new ones */
+        size_t bytes = random_size(thread);
+        size_t old = verify(ptr);
+        void *moved = tlsf_heap_realloc(&heap, ptr, bytes);
+        if (moved) {
+            if (old && memcmp(moved, &old, sizeof(old))) {
+                fail("realloc lost data", moved);
+            }
+            fill(moved, bytes);
+            thread->slots[index] = moved;
+        }
+        break;
+    }
+    case 1:
+        /* hand the block to whichever thread takes this shared slot */
+        thread->slots[index] = atomic_exchange(&shared[rng(thread) % STRESS_SHARED], ptr);
+        break;
+    default:
+        release(ptr);
+        thread->slots[index] = NULL;
+        break;
+    }
+}
+
+static void *run(void *arg)
+{
+    stress_thread_t *thread = arg;
+
+#ifdef TLSF_MALLOC_CACHE
+    host_cache_id = thread->id;
+#endif
+    for (unsigned i = 0; i < STRESS_STEPS; i++) {
+        step(thread);
+        if (thread->id == 0 && i % STRESS_CHECK_PERIOD == 0
+            && tlsf_heap_check(&heap)) {
+            fail("heap check failed", NULL);
+        }
+    }
+    for (unsigned i = 0; i < STRESS_SLOTS; i++) {
+        release(thread->slots[i]);
+        thread->slots[i] = NULL;
+    }
+#ifdef TLSF_MALLOC_CACHE
+    tlsf_heap_cache_flush(&heap);
+#endif
+    return NULL;
+}
+
+int main(void)
+{
+    static stress_thread_t threads[STRESS_THREADS];
+    pthread_t handles[STRESS_THREADS];
+    tlsf_fragmentation_t report;
+    tlsf_t tlsf = tlsf_create_with_pool(memory, sizeof(memory));
+
+    if (!tlsf) {
+        return 1;
+    }
+    tlsf_heap_init(&heap, tlsf);
+
+    for (unsigned i = 0; i < STRESS_THREADS; i++) {
+        threads[i].id = i;
+        threads[i].rng_state = 0x9e3779b9u * (i + 1);
+        pthread_create(&handles[i], NULL, run, &threads[i]);
+    }
+    for (unsigned i = 0; i < STRESS_THREADS; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    for (unsigned i = 0; i < STRESS_SHARED; i++) {
+        release(atomic_exchange(&shared[i], NULL));
+    }
+
+    if (tlsf_heap_check(&heap) || tlsf_check_pool(tlsf_get_pool(tlsf))) {
+        fail("final heap check failed", NULL);
+    }
+
+    /* Deferred frees and slab pages may keep the heap in pieces. */
+#ifdef TLSF_REMOTE_FREE
+    tlsf_heap_drain(&heap);
+#endif
+    tlsf_coalesce_ex(tlsf);
+#ifndef TLSF_MALLOC_SLAB
+    tlsf_heap_fragmentation_report(&heap, NULL, 0, &report);
+    if (report.free_blocks != 1) {
+        printf("stress: %u free blocks left\n", (unsigned)report.free_blocks);
+        atomic_fetch_add(&failures, 1);
+    }
+#else
+    (void)report;
+#endif
+
+    printf("stress: %u threads x %u steps, %u failures\n", STRESS_THREADS,
+           STRESS_STEPS, atomic_load(&failures));
+    return atomic_load(&failures) != 0;
+}
@@ -0,0 +1,111 @@
+#include "tlsf-arena.h"
+
+#include <stdint.h>
+
+static inline char *chunk_start(tlsf_arena_chunk_t *chunk)
+{
+    return (char *)(chunk + 1);
+}
+
+/* Add a chunk with room for bytes at TLSF_ARENA_ALIGN. */
+static tlsf_arena_chunk_t *chunk_add(tlsf_arena_t *arena, size_t bytes)
+{
+    tlsf_arena_chunk_t *chunk;
+
+    bytes += TLSF_ARENA_ALIGN - 1;
+    size_t total = sizeof(tlsf_arena_chunk_t) + bytes;
+    if (bytes < TLSF_ARENA_ALIGN - 1 || total < bytes) {
+        return NULL;
+    }
+    chunk = arena->heap ? tlsf_heap_malloc(arena->heap, total)
+                        : TLSF_MALLOC_NAME(malloc)(total);
+    if (chunk) {
+        chunk->prev = arena->chunk;
+        chunk->end = chunk_start(chunk) + bytes;
+        arena->chunk = chunk;
+        arena->pos = chunk_start(chunk);
+    }
+    return chunk;
+}
+
+/* Drop the newest chunk, the arena continues at the end of the older one. */
+static void chunk_drop(tlsf_arena_t *arena)
+{
+    tlsf_arena_chunk_t *chunk = arena->chunk;
+
+    arena->chunk = chunk->prev;
+    if (arena->heap) {
+        tlsf_heap_free(arena->heap, chunk);
+    }
+    else {
+        TLSF_MALLOC_NAME(free)(chunk);
+    }
+    arena->pos = arena->chunk ? arena->chunk->end : NULL;
+}
+
+bool tlsf_arena_init(tlsf_arena_t *arena, tlsf_heap_t *heap, size_t bytes,
+                     size_t grow)
+{
+    arena->heap = heap;
+    arena->chunk = NULL;
+    arena->pos = NULL;
+    arena->grow = grow;
+    return chunk_add(arena, bytes) != NULL;
+}
+
+void tlsf_arena_destroy(tlsf_arena_t *arena)
+{
+    while (arena->chunk) {
+        chunk_drop(arena);
+    }
+}
+
+void *tlsf_arena_memalign(tlsf_arena_t *arena, size_t align, size_t bytes)
+{
+    uintptr_t pos = ((uintptr_t)arena->pos + align - 1) & ~(uintptr_t)(align - 1);
+
+    if (!arena->chunk || pos > (uintptr_t)arena->chunk->end ||
+        bytes > (uintptr_t)arena->chunk->end - pos) {
+        size_t size = bytes + align;
+        if (!arena->grow || size < bytes) {
+            return NULL;
+        }
+        if (!chunk_add(arena, size > arena->grow ? size : arena->grow)) {
+            return NULL;
+        }
+        pos = ((uintptr_t)arena->pos + align - 1) & ~(uintptr_t)(align - 1);
+    }
+
+    arena->pos = (char *)(pos + bytes);
+    return (void *)pos;
+}
+
+void *tlsf_arena_alloc(tlsf_arena_t *arena, size_t bytes)
+{
+    return tlsf_arena_memalign(arena, TLSF_ARENA_ALIGN, bytes);
+}
+
+void tlsf_arena_reset(tlsf_arena_t *arena)
+{
+    if (!arena->chunk) {
+        return;
+    }
+    while (arena->chunk->prev) {
+        chunk_drop(arena);
+    }
+    arena->pos = chunk_start(arena->chunk);
+}
+
+tlsf_arena_mark_t tlsf_arena_mark(const tlsf_arena_t *arena)
+{
+    tlsf_arena_mark_t mark = { arena->chunk, arena->pos };
+    return mark;
+}
+
+void tlsf_arena_release(tlsf_arena_t *arena, tlsf_arena_mark_t mark)
+{
+    while (arena->chunk != mark.chunk) {
+        chunk_drop(arena);
+    }
+    arena->pos = mark.pos;
+}
@@ -0,0 +1,67 @@
+#ifndef __TLSF_ARENA_H
+#define __TLSF_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tlsf-malloc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** Scoped arenas: one large block is taken from a TLSF heap and handed out
+** by bumping a pointer, and everything is given back at once by
+** tlsf_arena_reset, tlsf_arena_release or tlsf_arena_destroy instead of by
+** one free per object. An arena created with a grow size chains further
+** blocks of at least that size when the current one is used up; without
+** chained blocks, reset and release are O(1). Arenas are not locked, only
+** the heap they take their blocks from is.
+*/
+#ifndef TLSF_ARENA_ALIGN
+#   define TLSF_ARENA_ALIGN (8)
+#endif
+
+typedef struct tlsf_arena_chunk {
+    struct tlsf_arena_chunk *prev;  /* older chunk, NULL for the first one */
+    char *end;
+} tlsf_arena_chunk_t;
+
+typedef struct {
+    tlsf_heap_t *heap;              /* NULL selects the default heap */
+    tlsf_arena_chunk_t *chunk;      /* newest chunk */
+    char *pos;
+    size_t grow;
+} tlsf_arena_t;
+
+/* A position in an arena to return to with tlsf_arena_release. */
+typedef struct {
+    tlsf_arena_chunk_t *chunk;
+    char *pos;
+} tlsf_arena_mark_t;
+
+/* Take the first block of bytes from heap; grow 0 keeps the arena fixed. */
+bool tlsf_arena_init(tlsf_arena_t *arena, tlsf_heap_t *heap, size_t bytes,
+                     size_t grow);
+
+/* Return all blocks of the arena to the heap. */
+void tlsf_arena_destroy(tlsf_arena_t *arena);
+
+/* Allocate aligned to TLSF_ARENA_ALIGN, or to a power of two align. */
+void *tlsf_arena_alloc(tlsf_arena_t *arena, size_t bytes);
+
+void *tlsf_arena_memalign(tlsf_arena_t *arena, size_t align, size_t bytes);
+
+/* Free everything allocated since tlsf_arena_init or since a mark. */
+void tlsf_arena_reset(tlsf_arena_t *arena);
+
+tlsf_arena_mark_t tlsf_arena_mark(const tlsf_arena_t *arena);
+
+void tlsf_arena_release(tlsf_arena_t *arena, tlsf_arena_mark_t mark);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
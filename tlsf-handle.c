@@ -0,0 +1,94 @@
+#include "tlsf-handle.h"
+
+static inline tlsf_heap_t *table_heap(tlsf_handles_t *table)
+{
+    return table->heap ? table->heap : tlsf_heap_default();
+}
+
+static inline tlsf_handle_slot_t *table_slot(tlsf_handles_t *table,
+                                             tlsf_handle_t handle)
+{
+    return (handle && handle <= TLSF_HANDLE_COUNT) ? &table->slot[handle - 1]
+                                                   : NULL;
+}
+
+void tlsf_handles_init(tlsf_handles_t *table, tlsf_heap_t *heap)
+{
+    table->heap = heap;
+    table->cursor = 0;
+    table->moved = false;
+    for (unsigned i = 0; i < TLSF_HANDLE_COUNT; i++) {
+        table->slot[i].ptr = NULL;
+        table->slot[i].locks = 0;
+    }
+}
+
+tlsf_handle_t tlsf_halloc(tlsf_handles_t *table, size_t bytes)
+{
+    for (unsigned i = 0; i < TLSF_HANDLE_COUNT; i++) {
+        tlsf_handle_slot_t *slot = &table->slot[i];
+        if (slot->ptr) {
+            continue;
+        }
+        /* Front-end caches hand out blocks that must not be moved. */
+        slot->ptr = tlsf_heap_malloc_flags(table_heap(table), bytes, 0);
+        slot->locks = 0;
+        return slot->ptr ? i + 1 : 0;
+    }
+    return 0;
+}
+
+void tlsf_hfree(tlsf_handles_t *table, tlsf_handle_t handle)
+{
+    tlsf_handle_slot_t *slot = table_slot(table, handle);
+
+    if (slot && slot->ptr) {
+        tlsf_heap_free(table_heap(table), slot->ptr);
+        slot->ptr = NULL;
+    }
+}
+
+void *tlsf_hlock(tlsf_handles_t *table, tlsf_handle_t handle)
+{
+    tlsf_handle_slot_t *slot = table_slot(table, handle);
+
+    if (!slot || !slot->ptr) {
+        return NULL;
+    }
+    slot->locks++;
+    return slot->ptr;
+}
+
+void tlsf_hunlock(tlsf_handles_t *table, tlsf_handle_t handle)
+{
+    tlsf_handle_slot_t *slot = table_slot(table, handle);
+
+    if (slot && slot->locks) {
+        slot->locks--;
+    }
+}
+
+bool tlsf_compact(tlsf_handles_t *table, uint32_t budget_us)
+{
+    uint32_t start = TLSF_HANDLE_TIME();
+
+    do {
+        tlsf_handle_slot_t *slot = &table->slot[table->cursor];
+        if (slot->ptr && !slot->locks) {
+            void *moved = tlsf_heap_move_down(table_heap(table), slot->ptr);
+            if (moved) {
+                slot->ptr = moved;
+                table->moved = true;
+            }
+        }
+        if (++table->cursor == TLSF_HANDLE_COUNT) {
+            table->cursor = 0;
+            if (!table->moved) {
+                return true;
+            }
+            table->moved = false;
+        }
+    } while ((uint32_t)(TLSF_HANDLE_TIME() - start) < budget_us);
+
+    return false;
+}
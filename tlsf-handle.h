@@ -0,0 +1,78 @@
+#ifndef __TLSF_HANDLE_H
+#define __TLSF_HANDLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tlsf-malloc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** Relocatable allocations for long-running devices. Memory allocated with
+** tlsf_halloc is referred to by a handle and only has an address while it
+** is locked; tlsf_compact may move unlocked allocations down into free
+** space before them so that free blocks merge into large ones again.
+** Handle tables are not locked, only the heap they allocate from is, so
+** a table must not be used from two contexts at the same time.
+**
+** TLSF_HANDLE_COUNT is the number of handles per table, and
+** TLSF_HANDLE_TIME() returns a free-running microsecond count for the
+** compaction budget, for example xtimer_now_usec(). The default of 0
+** lets every tlsf_compact call run until the heap is compacted.
+*/
+#ifndef TLSF_HANDLE_COUNT
+#   define TLSF_HANDLE_COUNT (32)
+#endif
+#ifndef TLSF_HANDLE_TIME
+#   define TLSF_HANDLE_TIME() (0)
+#endif
+
+/* 0 is never a valid handle. */
+typedef unsigned tlsf_handle_t;
+
+typedef struct {
+    void *ptr;                      /* NULL if the handle is unused */
+    unsigned locks;
+} tlsf_handle_slot_t;
+
+typedef struct {
+    tlsf_heap_t *heap;              /* NULL selects the default heap */
+    unsigned cursor;                /* next slot tlsf_compact looks at */
+    bool moved;                     /* whether this pass moved anything */
+    tlsf_handle_slot_t slot[TLSF_HANDLE_COUNT];
+} tlsf_handles_t;
+
+#define TLSF_HANDLES_INIT(HEAP) { .heap = (HEAP) }
+
+void tlsf_handles_init(tlsf_handles_t *table, tlsf_heap_t *heap);
+
+/* Returns 0 if the heap or the table is full. */
+tlsf_handle_t tlsf_halloc(tlsf_handles_t *table, size_t bytes);
+
+void tlsf_hfree(tlsf_handles_t *table, tlsf_handle_t handle);
+
+/*
+** Pin an allocation and return its address, which stays valid until the
+** matching tlsf_hunlock. Locks nest.
+*/
+void *tlsf_hlock(tlsf_handles_t *table, tlsf_handle_t handle);
+
+void tlsf_hunlock(tlsf_handles_t *table, tlsf_handle_t handle);
+
+/*
+** Move unlocked allocations down for about budget_us microseconds, at
+** least one step, each of which holds the heap lock for one move. A call
+** continues where the previous one stopped and returns true once a full
+** pass over the table had nothing left to move.
+*/
+bool tlsf_compact(tlsf_handles_t *table, uint32_t budget_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,46 +1,864 @@
-#include "irq.h"
 #include "tlsf-malloc.h"
 
+#if (TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_IRQ) || !defined(TLSF_MALLOC_IN_ISR)
+#include "irq.h"
+#endif
+
 #include <string.h>
 
-void *TLSF_MALLOC_NAME(malloc)(size_t bytes)
+#if defined(TLSF_MALLOC_TRACE) || defined(TLSF_MALLOC_LATENCY)
+#include <stdatomic.h>
+#endif
+
+#ifdef TLSF_MALLOC_TRACE
+#include <stdio.h>
+#endif
+
+static tlsf_heap_t default_heap = TLSF_HEAP_INIT(NULL);
+
+#ifdef TLSF_MALLOC_TRACE
+#if TLSF_MALLOC_TRACE_SIZE & (TLSF_MALLOC_TRACE_SIZE - 1)
+#error "TLSF_MALLOC_TRACE_SIZE must be a power of two"
+#endif
+
+/*
+** Writers claim a record number with an atomic increment. seq holds the
+** number + 1 of the record stored in a slot, or 0 while it is written, so
+** that the reader can detect slots that are incomplete or were overwritten.
+*/
+typedef struct {
+    atomic_uint seq;
+    tlsf_trace_entry_t entry;
+} trace_slot_t;
+
+static trace_slot_t trace_ring[TLSF_MALLOC_TRACE_SIZE];
+static atomic_uint trace_head;
+static unsigned trace_tail;
+
+static void trace_record(uint8_t op, size_t size, size_t align, void *ptr,
+                         void *old)
+{
+    unsigned index = atomic_fetch_add_explicit(&trace_head, 1,
+                                               memory_order_relaxed);
+    trace_slot_t *slot = &trace_ring[index & (TLSF_MALLOC_TRACE_SIZE - 1)];
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->entry.time = TLSF_MALLOC_TRACE_TIME();
+    slot->entry.op = op;
+    slot->entry.size = size;
+    slot->entry.align = align;
+    slot->entry.ptr = ptr;
+    slot->entry.old = old;
+    atomic_store_explicit(&slot->seq, index + 1, memory_order_release);
+}
+
+size_t tlsf_malloc_trace_read(tlsf_trace_entry_t *entries, size_t count,
+                              uint32_t *lost)
+{
+    size_t done = 0;
+
+    *lost = 0;
+    while (done < count) {
+        unsigned head = atomic_load_explicit(&trace_head, memory_order_acquire);
+        if (head == trace_tail) {
+            break;
+        }
+        if (head - trace_tail > TLSF_MALLOC_TRACE_SIZE) {
+            *lost += head - TLSF_MALLOC_TRACE_SIZE - trace_tail;
+            trace_tail = head - TLSF_MALLOC_TRACE_SIZE;
+        }
+
+        trace_slot_t *slot = &trace_ring[trace_tail & (TLSF_MALLOC_TRACE_SIZE - 1)];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != trace_tail + 1) {
+            if (seq && (int)(seq - (trace_tail + 1)) > 0) {
+                /* overwritten by a newer record */
+                ++*lost;
+                ++trace_tail;
+                continue;
+            }
+            /* still being written */
+            break;
+        }
+        entries[done] = slot->entry;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+            ++*lost;
+        }
+        else {
+            ++done;
+        }
+        ++trace_tail;
+    }
+    return done;
+}
+
+void tlsf_malloc_trace_dump(void)
+{
+    tlsf_trace_entry_t entry;
+    uint32_t lost;
+    size_t done;
+
+    do {
+        done = tlsf_malloc_trace_read(&entry, 1, &lost);
+        if (lost) {
+            printf("# lost %lu\n", (unsigned long)lost);
+        }
+        if (done) {
+            printf("T %u %lu %lu 0x%lx 0x%lx %lu\n", (unsigned)entry.op,
+                   (unsigned long)entry.size, (unsigned long)entry.align,
+                   (unsigned long)(uintptr_t)entry.ptr,
+                   (unsigned long)(uintptr_t)entry.old,
+                   (unsigned long)entry.time);
+        }
+    } while (done);
+}
+#else
+#define trace_record(op, size, align, ptr, old) ((void)0)
+#endif
+
+#ifdef TLSF_MALLOC_LATENCY
+#ifndef TLSF_MALLOC_LATENCY_CYCLES
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define LATENCY_DWT_CTRL    (*(volatile uint32_t *)0xE0001000)
+#define LATENCY_DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004)
+#define LATENCY_DEMCR       (*(volatile uint32_t *)0xE000EDFC)
+#define TLSF_MALLOC_LATENCY_CYCLES() (LATENCY_DWT_CYCCNT)
+#define TLSF_MALLOC_LATENCY_INIT() do { LATENCY_DEMCR |= (1UL << 24); \
+                                        LATENCY_DWT_CTRL |= 1UL; } while (0)
+#elif defined(__i386__) || defined(__x86_64__)
+#define TLSF_MALLOC_LATENCY_CYCLES() ((uint32_t)__builtin_ia32_rdtsc())
+#else
+#error "no cycle counter known for this CPU, define TLSF_MALLOC_LATENCY_CYCLES()"
+#endif
+#endif
+
+#ifndef TLSF_MALLOC_LATENCY_INIT
+#define TLSF_MALLOC_LATENCY_INIT() do { } while (0)
+#endif
+
+static atomic_uint latency_count[TLSF_LATENCY_COUNT][TLSF_LATENCY_BUCKETS];
+static atomic_uint latency_max[TLSF_LATENCY_COUNT];
+
+/* Record the cycles since start, unsigned arithmetic handles the wrap. */
+static void latency_record(unsigned op, uint32_t start)
+{
+    uint32_t cycles = (uint32_t)TLSF_MALLOC_LATENCY_CYCLES() - start;
+    unsigned bucket = cycles ? 32 - __builtin_clz(cycles) : 0;
+    unsigned max = atomic_load_explicit(&latency_max[op], memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&latency_count[op][bucket], 1,
+                              memory_order_relaxed);
+    while (cycles > max &&
+           !atomic_compare_exchange_weak_explicit(&latency_max[op], &max,
+                                                  cycles, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void tlsf_latency_stats(tlsf_latency_t *stats)
+{
+    for (unsigned op = 0; op < TLSF_LATENCY_COUNT; op++) {
+        for (unsigned i = 0; i < TLSF_LATENCY_BUCKETS; i++) {
+            stats->op[op].count[i] = atomic_load_explicit(
+                &latency_count[op][i], memory_order_relaxed);
+        }
+        stats->op[op].max = atomic_load_explicit(&latency_max[op],
+                                                 memory_order_relaxed);
+    }
+}
+
+void tlsf_latency_reset(void)
 {
+    TLSF_MALLOC_LATENCY_INIT();
+    for (unsigned op = 0; op < TLSF_LATENCY_COUNT; op++) {
+        for (unsigned i = 0; i < TLSF_LATENCY_BUCKETS; i++) {
+            atomic_store_explicit(&latency_count[op][i], 0,
+                                  memory_order_relaxed);
+        }
+        atomic_store_explicit(&latency_max[op], 0, memory_order_relaxed);
+    }
+}
+
+#define latency_start() ((uint32_t)TLSF_MALLOC_LATENCY_CYCLES())
+#else
+#define latency_start() (0)
+#define latency_record(op, start) ((void)(start))
+#endif
+
+#ifndef TLSF_MALLOC_IN_ISR
+#define TLSF_MALLOC_IN_ISR() irq_is_in()
+#endif
+
+static inline unsigned heap_lock(tlsf_heap_t *heap)
+{
+#if TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_IRQ
     unsigned old_state = irq_disable();
-    void *result = tlsf_malloc(bytes);
+#elif TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_MUTEX
+    mutex_lock(&heap->lock);
+    unsigned old_state = 0;
+#elif TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_PTHREAD
+    pthread_mutex_lock(&heap->lock);
+    unsigned old_state = 0;
+#else
+    unsigned old_state = 0;
+#endif
+#ifdef TLSF_MALLOC_LATENCY
+    heap->lock_start = latency_start();
+#else
+    (void)heap;
+#endif
+    return old_state;
+}
+
+static inline void heap_unlock(tlsf_heap_t *heap, unsigned old_state)
+{
+#ifdef TLSF_MALLOC_LATENCY
+    latency_record(TLSF_LATENCY_LOCKED, heap->lock_start);
+#endif
+#if TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_IRQ
+    (void)heap;
     irq_restore(old_state);
+#elif TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_MUTEX
+    (void)old_state;
+    mutex_unlock(&heap->lock);
+#elif TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_PTHREAD
+    (void)old_state;
+    pthread_mutex_unlock(&heap->lock);
+#else
+    (void)heap;
+    (void)old_state;
+#endif
+}
+
+static inline tlsf_t heap_tlsf(tlsf_heap_t *heap)
+{
+    return heap->tlsf ? heap->tlsf : tlsf_get_default();
+}
+
+#ifdef TLSF_MALLOC_CACHE
+static inline tlsf_heap_cache_t *heap_cache(tlsf_heap_t *heap)
+{
+#ifdef TLSF_MALLOC_CACHE_ID
+    int id = TLSF_MALLOC_CACHE_ID();
+#else
+    int id = TLSF_MALLOC_IN_ISR() ? -1 : (int)(thread_getpid() - KERNEL_PID_FIRST);
+#endif
+    if (id < 0 || id >= TLSF_MALLOC_CACHE_COUNT) {
+        return NULL;
+    }
+    return &heap->cache[id];
+}
+
+/* Refill an empty magazine with a batch of blocks of its class. */
+static void cache_refill(tlsf_heap_t *heap, tlsf_heap_cache_t *cache,
+                         int sclass)
+{
+    size_t bytes = tlsf_class_size(sclass);
+    unsigned old_state = heap_lock(heap);
+    while (cache->count[sclass] < TLSF_MALLOC_CACHE_BATCH) {
+        void *ptr = tlsf_malloc_ex(heap_tlsf(heap), bytes);
+        if (!ptr) {
+            break;
+        }
+        cache->slot[sclass][cache->count[sclass]++] = ptr;
+    }
+    heap_unlock(heap, old_state);
+}
+
+/* Drain a batch of blocks from a full magazine back to the heap. */
+static void cache_drain(tlsf_heap_t *heap, tlsf_heap_cache_t *cache,
+                        int sclass, unsigned batch)
+{
+    unsigned old_state = heap_lock(heap);
+    while (batch-- && cache->count[sclass]) {
+        tlsf_free_ex(heap_tlsf(heap),
+                     cache->slot[sclass][--cache->count[sclass]]);
+    }
+    heap_unlock(heap, old_state);
+}
+
+void tlsf_heap_cache_flush(tlsf_heap_t *heap)
+{
+    tlsf_heap_cache_t *cache = heap_cache(heap);
+    if (cache) {
+        for (int sclass = 0; sclass < TLSF_MALLOC_CACHE_CLASSES; sclass++) {
+            cache_drain(heap, cache, sclass, TLSF_MALLOC_CACHE_DEPTH);
+        }
+    }
+}
+#endif
+
+#ifdef TLSF_MALLOC_SLAB
+#if (TLSF_MALLOC_SLAB_MAX % TLSF_MALLOC_SLAB_STEP) || \
+    (TLSF_MALLOC_SLAB_PAGE < TLSF_MALLOC_SLAB_MAX)
+#error "TLSF_MALLOC_SLAB_MAX must be a multiple of TLSF_MALLOC_SLAB_STEP and fit a page"
+#endif
+#if defined(TLSF_ALIGN_SIZE_LOG2) && \
+    (TLSF_MALLOC_SLAB_STEP % (1 << TLSF_ALIGN_SIZE_LOG2))
+#error "TLSF_MALLOC_SLAB_STEP must be a multiple of 1 << TLSF_ALIGN_SIZE_LOG2"
+#endif
+#if defined(TLSF_REMOTE_FREE) && (TLSF_MALLOC_LOCK >= TLSF_MALLOC_LOCK_MUTEX)
+#error "TLSF_MALLOC_SLAB needs the heap lock to free from interrupt context"
+#endif
+
+static inline size_t slab_object_size(unsigned sclass)
+{
+    return (sclass + 1) * TLSF_MALLOC_SLAB_STEP;
+}
+
+static inline unsigned slab_objects(unsigned sclass)
+{
+    return TLSF_MALLOC_SLAB_PAGE / slab_object_size(sclass);
+}
+
+/* Find the page that holds ptr, the heap must be locked. */
+static tlsf_slab_page_t *slab_find(tlsf_heap_t *heap, const void *ptr)
+{
+    uintptr_t addr = (uintptr_t)ptr;
+    unsigned low = 0;
+    unsigned high = heap->slab.count;
+
+    while (low < high) {
+        unsigned mid = (low + high) / 2;
+        tlsf_slab_page_t *page = &heap->slab.page[mid];
+        if (addr < (uintptr_t)page->base) {
+            high = mid;
+        }
+        else if (addr >= (uintptr_t)page->base + TLSF_MALLOC_SLAB_PAGE) {
+            low = mid + 1;
+        }
+        else {
+            return page;
+        }
+    }
+    return NULL;
+}
+
+static tlsf_slab_page_t *slab_add_page(tlsf_heap_t *heap, unsigned sclass)
+{
+    tlsf_heap_slab_t *slab = &heap->slab;
+    unsigned objects = slab_objects(sclass);
+
+    if (slab->count == TLSF_MALLOC_SLAB_PAGES) {
+        return NULL;
+    }
+
+    char *base = tlsf_memalign_ex(heap_tlsf(heap), TLSF_MALLOC_SLAB_STEP,
+                                  TLSF_MALLOC_SLAB_PAGE);
+    if (!base) {
+        return NULL;
+    }
+
+    unsigned i = slab->count++;
+    while (i && (uintptr_t)slab->page[i - 1].base > (uintptr_t)base) {
+        slab->page[i] = slab->page[i - 1];
+        i--;
+    }
+
+    tlsf_slab_page_t *page = &slab->page[i];
+    page->base = base;
+    page->used = 0;
+    page->sclass = sclass;
+    /* slots past the last object are marked as taken */
+    for (unsigned w = 0; w < TLSF_MALLOC_SLAB_WORDS; w++) {
+        unsigned first = w * 32;
+        if (objects >= first + 32) {
+            page->map[w] = 0;
+        }
+        else if (objects <= first) {
+            page->map[w] = UINT32_MAX;
+        }
+        else {
+            page->map[w] = UINT32_MAX << (objects - first);
+        }
+    }
+    return page;
+}
+
+/* Allocate an object of up to TLSF_MALLOC_SLAB_MAX bytes, heap locked. */
+static void *slab_malloc(tlsf_heap_t *heap, size_t bytes)
+{
+    unsigned sclass = (bytes - 1) / TLSF_MALLOC_SLAB_STEP;
+    tlsf_slab_page_t *page = NULL;
+
+    for (unsigned i = 0; i < heap->slab.count; i++) {
+        tlsf_slab_page_t *candidate = &heap->slab.page[i];
+        if (candidate->sclass == sclass &&
+            candidate->used < slab_objects(sclass)) {
+            page = candidate;
+            break;
+        }
+    }
+    if (!page && !(page = slab_add_page(heap, sclass))) {
+        return NULL;
+    }
+
+    unsigned w = 0;
+    while (page->map[w] == UINT32_MAX) {
+        w++;
+    }
+    unsigned bit = __builtin_ctz(~page->map[w]);
+    page->map[w] |= 1UL << bit;
+    page->used++;
+    return page->base + (w * 32 + bit) * slab_object_size(sclass);
+}
+
+/*
+** Free an object, heap locked. An empty page goes back to the heap unless
+** it is the only page of its class with free slots, so that a single
+** object being allocated and freed does not take a page each time.
+*/
+static void slab_free(tlsf_heap_t *heap, tlsf_slab_page_t *page, void *ptr)
+{
+    tlsf_heap_slab_t *slab = &heap->slab;
+    size_t index = ((char *)ptr - page->base) / slab_object_size(page->sclass);
+
+    page->map[index / 32] &= ~(1UL << (index % 32));
+    if (--page->used) {
+        return;
+    }
+
+    for (unsigned i = 0; i < slab->count; i++) {
+        tlsf_slab_page_t *other = &slab->page[i];
+        if (other != page && other->sclass == page->sclass &&
+            other->used < slab_objects(other->sclass)) {
+            tlsf_free_ex(heap_tlsf(heap), page->base);
+            slab->count--;
+            for (i = page - slab->page; i < slab->count; i++) {
+                slab->page[i] = slab->page[i + 1];
+            }
+            return;
+        }
+    }
+}
+
+/*
+** Return the object size if ptr lies in a slab page and 0 otherwise. With
+** release set, the object is freed as well.
+*/
+static size_t slab_lookup(tlsf_heap_t *heap, void *ptr, bool release)
+{
+    size_t size = 0;
+    unsigned old_state = heap_lock(heap);
+    tlsf_slab_page_t *page = slab_find(heap, ptr);
+    if (page) {
+        size = slab_object_size(page->sclass);
+        if (release) {
+            slab_free(heap, page, ptr);
+        }
+    }
+    heap_unlock(heap, old_state);
+    return size;
+}
+#endif
+
+void tlsf_heap_init(tlsf_heap_t *heap, tlsf_t tlsf)
+{
+    tlsf_heap_t init = TLSF_HEAP_INIT(tlsf);
+    *heap = init;
+}
+
+void *tlsf_heap_malloc(tlsf_heap_t *heap, size_t bytes)
+{
+#ifdef TLSF_MALLOC_SLAB
+    if (bytes && bytes <= TLSF_MALLOC_SLAB_MAX) {
+        unsigned old_state = heap_lock(heap);
+        void *result = slab_malloc(heap, bytes);
+        heap_unlock(heap, old_state);
+        if (result) {
+            return result;
+        }
+    }
+#endif
+#ifdef TLSF_MALLOC_CACHE
+    tlsf_heap_cache_t *cache = heap_cache(heap);
+    int sclass = tlsf_size_class(bytes);
+    if (cache && sclass >= 0 && sclass < TLSF_MALLOC_CACHE_CLASSES) {
+        if (!cache->count[sclass]) {
+            cache_refill(heap, cache, sclass);
+        }
+        if (cache->count[sclass]) {
+            return cache->slot[sclass][--cache->count[sclass]];
+        }
+        /* Blocks parked in our own magazines might be mergeable. */
+        tlsf_heap_cache_flush(heap);
+    }
+#endif
+    unsigned old_state = heap_lock(heap);
+    void *result = tlsf_malloc_ex(heap_tlsf(heap), bytes);
+    heap_unlock(heap, old_state);
     return result;
 }
 
-void *TLSF_MALLOC_NAME(calloc)(size_t count, size_t bytes)
+void *tlsf_heap_malloc_at_least(tlsf_heap_t *heap, size_t bytes,
+                                size_t *actual)
 {
-    unsigned old_state = irq_disable();
-    void *result = tlsf_malloc(count * bytes);
+    void *result = tlsf_heap_malloc(heap, bytes);
+    *actual = result ? tlsf_heap_usable_size(heap, result) : 0;
+    return result;
+}
+
+void *tlsf_heap_malloc_flags(tlsf_heap_t *heap, size_t bytes, unsigned flags)
+{
+    unsigned old_state = heap_lock(heap);
+    void *result = tlsf_malloc_flags_ex(heap_tlsf(heap), bytes, flags);
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+void *tlsf_heap_malloc_tagged(tlsf_heap_t *heap, unsigned tag, size_t bytes)
+{
+    unsigned old_state = heap_lock(heap);
+    void *result = tlsf_malloc_tagged_ex(heap_tlsf(heap), tag, bytes);
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+void tlsf_heap_set_tag_budget(tlsf_heap_t *heap, unsigned tag, size_t bytes)
+{
+    unsigned old_state = heap_lock(heap);
+    tlsf_set_tag_budget_ex(heap_tlsf(heap), tag, bytes);
+    heap_unlock(heap, old_state);
+}
+
+size_t tlsf_heap_tag_used(tlsf_heap_t *heap, unsigned tag)
+{
+    unsigned old_state = heap_lock(heap);
+    size_t result = tlsf_tag_used_ex(heap_tlsf(heap), tag);
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+void *tlsf_heap_calloc(tlsf_heap_t *heap, size_t count, size_t bytes)
+{
+    if (bytes && count > SIZE_MAX / bytes) {
+        return NULL;
+    }
+
+    size_t total = count * bytes;
+    size_t dirty = total;
+    void *result;
+
+    /* Blocks from the front-ends are small and never known to be zero. */
+#ifdef TLSF_MALLOC_SLAB
+    if (total && total <= TLSF_MALLOC_SLAB_MAX) {
+        result = tlsf_heap_malloc(heap, total);
+    }
+    else
+#endif
+#ifdef TLSF_MALLOC_CACHE
+    if (tlsf_size_class(total) >= 0 &&
+        tlsf_size_class(total) < TLSF_MALLOC_CACHE_CLASSES) {
+        result = tlsf_heap_malloc(heap, total);
+    }
+    else
+#endif
+    {
+        unsigned old_state = heap_lock(heap);
+        result = tlsf_malloc_clean_ex(heap_tlsf(heap), total, &dirty);
+        heap_unlock(heap, old_state);
+    }
+
+    /* Clear the block outside of the critical section. */
     if (result) {
-        memset(result, 0, count * bytes);
+        memset(result, 0, dirty);
     }
-    irq_restore(old_state);
+    return result;
+}
+
+void *tlsf_heap_memalign(tlsf_heap_t *heap, size_t align, size_t bytes)
+{
+    unsigned old_state = heap_lock(heap);
+    void *result = tlsf_memalign_ex(heap_tlsf(heap), align, bytes);
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+void *tlsf_heap_realloc(tlsf_heap_t *heap, void *ptr, size_t size)
+{
+    if (!ptr) {
+        return tlsf_heap_malloc(heap, size);
+    }
+    if (!size) {
+        tlsf_heap_free(heap, ptr);
+        return NULL;
+    }
+
+#ifdef TLSF_MALLOC_SLAB
+    size_t slab_size = slab_lookup(heap, ptr, false);
+    if (slab_size) {
+        if (size <= slab_size) {
+            return ptr;
+        }
+        void *result = tlsf_heap_malloc(heap, size);
+        if (result) {
+            memcpy(result, ptr, slab_size);
+            tlsf_heap_free(heap, ptr);
+        }
+        return result;
+    }
+#endif
+
+    /*
+     * Only resize in place with the lock held: tlsf_resize_move_ex would
+     * copy the block into a free previous block inside the critical
+     * section.
+     */
+    unsigned old_state = heap_lock(heap);
+    void *result = tlsf_resize_ex(heap_tlsf(heap), ptr, size);
+    if (result) {
+        heap_unlock(heap, old_state);
+        return result;
+    }
+    result = tlsf_malloc_tagged_ex(heap_tlsf(heap), tlsf_block_tag(ptr), size);
+    heap_unlock(heap, old_state);
+
+    /*
+     * The old block still belongs to the caller, so it can be copied
+     * without holding the lock.
+     */
+    if (result) {
+        size_t old_size = tlsf_usable_size(ptr);
+        memcpy(result, ptr, old_size < size ? old_size : size);
+        tlsf_heap_free(heap, ptr);
+    }
+    return result;
+}
+
+void *tlsf_heap_move_down(tlsf_heap_t *heap, void *ptr)
+{
+    unsigned old_state = heap_lock(heap);
+    void *result = tlsf_move_down_ex(heap_tlsf(heap), ptr);
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+size_t tlsf_heap_usable_size(tlsf_heap_t *heap, void *ptr)
+{
+#ifdef TLSF_MALLOC_SLAB
+    size_t slab_size = ptr ? slab_lookup(heap, ptr, false) : 0;
+    if (slab_size) {
+        return slab_size;
+    }
+#else
+    (void)heap;
+#endif
+    return tlsf_usable_size(ptr);
+}
+
+bool tlsf_heap_try_expand(tlsf_heap_t *heap, void *ptr, size_t size)
+{
+    if (size <= tlsf_heap_usable_size(heap, ptr)) {
+        return true;
+    }
+#ifdef TLSF_MALLOC_SLAB
+    if (slab_lookup(heap, ptr, false)) {
+        return false;
+    }
+#endif
+    unsigned old_state = heap_lock(heap);
+    bool result = tlsf_try_expand_ex(heap_tlsf(heap), ptr, size);
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+/*
+** A size of 0 is not known. Larger sizes than TLSF_MALLOC_SLAB_MAX cannot
+** belong to a slab object, which saves the lookup under the heap lock,
+** and blocks of at least the smallest size of the first uncached class
+** skip the magazines without looking up the cache and the block class.
+*/
+static void heap_free(tlsf_heap_t *heap, void *ptr, size_t size)
+{
+#ifdef TLSF_MALLOC_SLAB
+    if (ptr && size <= TLSF_MALLOC_SLAB_MAX && slab_lookup(heap, ptr, true)) {
+        return;
+    }
+#endif
+#ifdef TLSF_REMOTE_FREE
+    /* Never wait for the heap in interrupt context, defer the free. */
+    if (TLSF_MALLOC_IN_ISR()) {
+        tlsf_free_remote_ex(heap_tlsf(heap), ptr);
+        return;
+    }
+#endif
+#ifdef TLSF_MALLOC_CACHE
+    tlsf_heap_cache_t *cache = size < tlsf_class_size(TLSF_MALLOC_CACHE_CLASSES)
+                             ? heap_cache(heap) : NULL;
+    /* Tagged blocks are never cached, their bytes belong to the tag. */
+    if (cache && ptr && !tlsf_block_tag(ptr)) {
+        int sclass = tlsf_block_class(ptr);
+        if (sclass < TLSF_MALLOC_CACHE_CLASSES) {
+            if (cache->count[sclass] == TLSF_MALLOC_CACHE_DEPTH) {
+                cache_drain(heap, cache, sclass, TLSF_MALLOC_CACHE_BATCH);
+            }
+            cache->slot[sclass][cache->count[sclass]++] = ptr;
+            return;
+        }
+    }
+#endif
+    unsigned old_state = heap_lock(heap);
+    tlsf_free_sized_ex(heap_tlsf(heap), ptr, size);
+    heap_unlock(heap, old_state);
+}
+
+void tlsf_heap_free(tlsf_heap_t *heap, void *ptr)
+{
+    heap_free(heap, ptr, 0);
+}
+
+void tlsf_heap_free_sized(tlsf_heap_t *heap, void *ptr, size_t size)
+{
+    heap_free(heap, ptr, size);
+}
+
+#ifdef TLSF_RELEASE_HOOKS
+void tlsf_heap_set_release_hooks(tlsf_heap_t *heap, tlsf_release_hook release,
+                                 tlsf_release_hook acquire, size_t granule,
+                                 size_t threshold, void *user)
+{
+    unsigned old_state = heap_lock(heap);
+    tlsf_set_release_hooks_ex(heap_tlsf(heap), release, acquire, granule,
+                              threshold, user);
+    heap_unlock(heap, old_state);
+}
+#endif
+
+#ifdef TLSF_REMOTE_FREE
+void tlsf_heap_drain(tlsf_heap_t *heap)
+{
+    unsigned old_state = heap_lock(heap);
+    tlsf_drain_ex(heap_tlsf(heap));
+    heap_unlock(heap, old_state);
+}
+#endif
+
+size_t tlsf_heap_malloc_batch(tlsf_heap_t *heap, size_t bytes, size_t count,
+                              void **ptrs)
+{
+    unsigned old_state = heap_lock(heap);
+    size_t result = tlsf_malloc_batch_ex(heap_tlsf(heap), bytes, count, ptrs);
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+void tlsf_heap_free_batch(tlsf_heap_t *heap, void **ptrs, size_t count)
+{
+#ifdef TLSF_REMOTE_FREE
+    if (TLSF_MALLOC_IN_ISR()) {
+        for (size_t i = 0; i < count; i++) {
+            tlsf_heap_free(heap, ptrs[i]);
+        }
+        return;
+    }
+#endif
+    unsigned old_state = heap_lock(heap);
+#ifdef TLSF_MALLOC_SLAB
+    for (size_t i = 0; i < count; i++) {
+        tlsf_slab_page_t *page = ptrs[i] ? slab_find(heap, ptrs[i]) : NULL;
+        if (page) {
+            slab_free(heap, page, ptrs[i]);
+            ptrs[i] = NULL;
+        }
+    }
+#endif
+    tlsf_free_batch_ex(heap_tlsf(heap), ptrs, count);
+    heap_unlock(heap, old_state);
+}
+
+int tlsf_heap_check(tlsf_heap_t *heap)
+{
+    unsigned old_state = heap_lock(heap);
+    int result = tlsf_check_ex(heap_tlsf(heap));
+    heap_unlock(heap, old_state);
+    return result;
+}
+
+void tlsf_heap_fragmentation_report(tlsf_heap_t *heap, tlsf_bucket_t *buckets,
+                                    size_t count, tlsf_fragmentation_t *report)
+{
+    unsigned old_state = heap_lock(heap);
+    tlsf_fragmentation_report_ex(heap_tlsf(heap), buckets, count, report);
+    heap_unlock(heap, old_state);
+}
+
+#ifdef TLSF_STATS
+void tlsf_heap_get_stats(tlsf_heap_t *heap, tlsf_stats_t *stats)
+{
+    unsigned old_state = heap_lock(heap);
+    tlsf_get_stats_ex(heap_tlsf(heap), stats);
+    heap_unlock(heap, old_state);
+}
+#endif
+
+tlsf_heap_t *tlsf_heap_default(void)
+{
+    return &default_heap;
+}
+
+/*
+** Frees are recorded before and allocations after the call, so that the
+** trace never shows an address handed out again before it was freed.
+*/
+void *TLSF_MALLOC_NAME(malloc)(size_t bytes)
+{
+    uint32_t start = latency_start();
+    void *result = tlsf_heap_malloc(&default_heap, bytes);
+    latency_record(TLSF_LATENCY_MALLOC, start);
+    trace_record(TLSF_TRACE_MALLOC, bytes, 0, result, NULL);
+    return result;
+}
+
+void *TLSF_MALLOC_NAME(calloc)(size_t count, size_t bytes)
+{
+    uint32_t start = latency_start();
+    void *result = tlsf_heap_calloc(&default_heap, count, bytes);
+    latency_record(TLSF_LATENCY_MALLOC, start);
+    trace_record(TLSF_TRACE_MALLOC, count * bytes, 0, result, NULL);
     return result;
 }
 
 void *TLSF_MALLOC_NAME(memalign)(size_t align, size_t bytes)
 {
-    unsigned old_state = irq_disable();
-    void *result = tlsf_memalign(align, bytes);
-    irq_restore(old_state);
+    uint32_t start = latency_start();
+    void *result = tlsf_heap_memalign(&default_heap, align, bytes);
+    latency_record(TLSF_LATENCY_MEMALIGN, start);
+    trace_record(TLSF_TRACE_MEMALIGN, bytes, align, result, NULL);
     return result;
 }
 
 void *TLSF_MALLOC_NAME(realloc)(void *ptr, size_t size)
 {
-    unsigned old_state = irq_disable();
-    void *result = tlsf_realloc(ptr, size);
-    irq_restore(old_state);
+    uint32_t start = latency_start();
+    void *result = tlsf_heap_realloc(&default_heap, ptr, size);
+    latency_record(TLSF_LATENCY_REALLOC, start);
+    trace_record(TLSF_TRACE_REALLOC, size, 0, result, ptr);
     return result;
 }
 
 void TLSF_MALLOC_NAME(free)(void *ptr)
 {
-    unsigned old_state = irq_disable();
-    tlsf_free(ptr);
-    irq_restore(old_state);
+    uint32_t start;
+
+    trace_record(TLSF_TRACE_FREE, 0, 0, ptr, NULL);
+    start = latency_start();
+    tlsf_heap_free(&default_heap, ptr);
+    latency_record(TLSF_LATENCY_FREE, start);
+}
+
+void TLSF_MALLOC_NAME(free_sized)(void *ptr, size_t size)
+{
+    uint32_t start;
+
+    trace_record(TLSF_TRACE_FREE, 0, 0, ptr, NULL);
+    start = latency_start();
+    tlsf_heap_free_sized(&default_heap, ptr, size);
+    latency_record(TLSF_LATENCY_FREE, start);
+}
+
+size_t TLSF_MALLOC_NAME(malloc_usable_size)(void *ptr)
+{
+    return tlsf_heap_usable_size(&default_heap, ptr);
 }
@@ -3,9 +3,342 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "tlsf.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** Locking policies for the heaps below:
+** - TLSF_MALLOC_LOCK_NONE: no locking, the user must serialize accesses
+** - TLSF_MALLOC_LOCK_IRQ: mask interrupts around every allocator call
+** - TLSF_MALLOC_LOCK_MUTEX: one mutex per heap (not usable from ISRs)
+** - TLSF_MALLOC_LOCK_PTHREAD: one POSIX mutex per heap, for host builds
+**
+** TLSF_MALLOC_IN_ISR() tells whether the caller runs in interrupt context,
+** for TLSF_REMOTE_FREE and the default cache id; it defaults to RIOT's
+** irq_is_in(), host builds may define it as 0.
+*/
+#define TLSF_MALLOC_LOCK_NONE       (0)
+#define TLSF_MALLOC_LOCK_IRQ        (1)
+#define TLSF_MALLOC_LOCK_MUTEX      (2)
+#define TLSF_MALLOC_LOCK_PTHREAD    (3)
+
+#ifndef TLSF_MALLOC_LOCK
+#   define TLSF_MALLOC_LOCK TLSF_MALLOC_LOCK_IRQ
+#endif
+
+#if TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_MUTEX
+#   include "mutex.h"
+#elif TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_PTHREAD
+#   include <pthread.h>
+#endif
+
+/*
+** Optional per-thread front-end cache (TLSF_MALLOC_CACHE). Each thread
+** keeps a magazine of recently freed blocks for the smallest size classes
+** (see tlsf_size_class()) and only takes the heap lock to refill or drain
+** a magazine in batches. TLSF_MALLOC_CACHE_ID() maps the caller to its
+** magazine set, or to a negative number to bypass the cache; the default
+** uses the RIOT thread id and bypasses the cache in interrupt context.
+** A custom TLSF_MALLOC_CACHE_ID() must be defined together with
+** TLSF_MALLOC_CACHE_COUNT, the number of magazine sets per heap, and ids
+** of TLSF_MALLOC_CACHE_COUNT and above bypass the cache as well.
+** A magazine set must never be used by two contexts at the same time.
+*/
+#ifdef TLSF_MALLOC_CACHE
+#   ifndef TLSF_MALLOC_CACHE_CLASSES
+#       define TLSF_MALLOC_CACHE_CLASSES (16)
+#   endif
+#   ifndef TLSF_MALLOC_CACHE_DEPTH
+#       define TLSF_MALLOC_CACHE_DEPTH (8)
+#   endif
+#   ifndef TLSF_MALLOC_CACHE_BATCH
+#       define TLSF_MALLOC_CACHE_BATCH (TLSF_MALLOC_CACHE_DEPTH / 2)
+#   endif
+#   if defined(TLSF_MALLOC_CACHE_ID) != defined(TLSF_MALLOC_CACHE_COUNT)
+#       error "TLSF_MALLOC_CACHE_ID() and TLSF_MALLOC_CACHE_COUNT must be defined together"
+#   elif !defined(TLSF_MALLOC_CACHE_ID)
+#       include "thread.h"
+#       define TLSF_MALLOC_CACHE_COUNT (MAXTHREADS)
+#   endif
+
+typedef struct {
+    unsigned char count[TLSF_MALLOC_CACHE_CLASSES];
+    void *slot[TLSF_MALLOC_CACHE_CLASSES][TLSF_MALLOC_CACHE_DEPTH];
+} tlsf_heap_cache_t;
+#endif
+
+/*
+** Optional slab front-end for tiny objects (TLSF_MALLOC_SLAB). Requests of
+** up to TLSF_MALLOC_SLAB_MAX bytes are served from pages of
+** TLSF_MALLOC_SLAB_PAGE bytes taken from the heap, each holding objects of
+** one size class (a multiple of TLSF_MALLOC_SLAB_STEP) without per-object
+** headers. The step must be a multiple of the TLSF alignment, so that slab
+** objects are aligned like heap blocks; its default is the larger of 8 and
+** 1 << TLSF_ALIGN_SIZE_LOG2. Free slots are tracked in a bitmap per page,
+** and frees find their page by a binary search over the address-sorted page
+** registry, so freeing takes the heap lock for the lookup. At most
+** TLSF_MALLOC_SLAB_PAGES pages exist; beyond that, tiny requests go to the
+** heap as usual.
+*/
+#ifdef TLSF_MALLOC_SLAB
+#   ifndef TLSF_MALLOC_SLAB_STEP
+#       if defined(TLSF_ALIGN_SIZE_LOG2) && (TLSF_ALIGN_SIZE_LOG2 > 3)
+#           define TLSF_MALLOC_SLAB_STEP (1 << TLSF_ALIGN_SIZE_LOG2)
+#       else
+#           define TLSF_MALLOC_SLAB_STEP (8)
+#       endif
+#   endif
+#   ifndef TLSF_MALLOC_SLAB_MAX
+        /* 48 bytes, rounded up to a whole step */
+#       define TLSF_MALLOC_SLAB_MAX \
+            ((47 / TLSF_MALLOC_SLAB_STEP + 1) * TLSF_MALLOC_SLAB_STEP)
+#   endif
+#   ifndef TLSF_MALLOC_SLAB_PAGE
+#       define TLSF_MALLOC_SLAB_PAGE (512)
+#   endif
+#   ifndef TLSF_MALLOC_SLAB_PAGES
+#       define TLSF_MALLOC_SLAB_PAGES (16)
+#   endif
+#   define TLSF_MALLOC_SLAB_WORDS \
+        ((TLSF_MALLOC_SLAB_PAGE / TLSF_MALLOC_SLAB_STEP + 31) / 32)
+
+typedef struct {
+    char *base;
+    uint16_t used;
+    uint8_t sclass;
+    uint32_t map[TLSF_MALLOC_SLAB_WORDS];   /* set bits are taken */
+} tlsf_slab_page_t;
+
+typedef struct {
+    unsigned count;
+    tlsf_slab_page_t page[TLSF_MALLOC_SLAB_PAGES];  /* sorted by address */
+} tlsf_heap_slab_t;
+#endif
+
+/*
+** Optional allocation trace (TLSF_MALLOC_TRACE). The wrappers around the
+** default heap record every call into a lock-free ring buffer of
+** TLSF_MALLOC_TRACE_SIZE entries (a power of two) that overwrites the
+** oldest entries when it is not drained in time. TLSF_MALLOC_TRACE_TIME()
+** provides the timestamp, for example xtimer_now_usec().
+*/
+#ifdef TLSF_MALLOC_TRACE
+#   ifndef TLSF_MALLOC_TRACE_SIZE
+#       define TLSF_MALLOC_TRACE_SIZE (256)
+#   endif
+#   ifndef TLSF_MALLOC_TRACE_TIME
+#       define TLSF_MALLOC_TRACE_TIME() (0)
+#   endif
+
+enum {
+    TLSF_TRACE_MALLOC,      /* calloc is recorded as malloc */
+    TLSF_TRACE_FREE,
+    TLSF_TRACE_REALLOC,
+    TLSF_TRACE_MEMALIGN,
+};
+
+typedef struct {
+    uint32_t time;
+    uint8_t op;
+    size_t size;
+    size_t align;           /* memalign only */
+    void *ptr;              /* pointer returned, or freed */
+    void *old;              /* realloc only: pointer passed in */
+} tlsf_trace_entry_t;
+#endif
+
+/*
+** Optional latency histograms (TLSF_MALLOC_LATENCY). The wrappers around
+** the default heap time every call with TLSF_MALLOC_LATENCY_CYCLES(), a
+** free-running 32 bit cycle counter that defaults to DWT->CYCCNT on
+** ARMv7-M and the TSC on x86, and the time the heap lock of any heap is
+** held is recorded separately. Call tlsf_latency_reset() once before,
+** which starts the DWT counter. Bucket 0 counts calls of 0 cycles, bucket
+** i those of 2^(i-1) up to 2^i - 1 cycles.
+*/
+#ifdef TLSF_MALLOC_LATENCY
+#   define TLSF_LATENCY_BUCKETS (33)
+
+enum {
+    TLSF_LATENCY_MALLOC,    /* calloc is recorded as malloc */
+    TLSF_LATENCY_FREE,
+    TLSF_LATENCY_REALLOC,
+    TLSF_LATENCY_MEMALIGN,
+    TLSF_LATENCY_LOCKED,    /* heap lock held, irq_disable for IRQ locking */
+    TLSF_LATENCY_COUNT,
+};
+
+typedef struct {
+    uint32_t count[TLSF_LATENCY_BUCKETS];
+    uint32_t max;           /* longest call in cycles */
+} tlsf_latency_histogram_t;
+
+typedef struct {
+    tlsf_latency_histogram_t op[TLSF_LATENCY_COUNT];
+} tlsf_latency_t;
+#endif
+
+/* A TLSF instance together with the lock that protects it. */
+typedef struct {
+    tlsf_t tlsf;        /* NULL selects the default TLSF instance */
+#if TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_MUTEX
+    mutex_t lock;
+#elif TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_PTHREAD
+    pthread_mutex_t lock;
+#endif
+#ifdef TLSF_MALLOC_CACHE
+    tlsf_heap_cache_t cache[TLSF_MALLOC_CACHE_COUNT];
+#endif
+#ifdef TLSF_MALLOC_SLAB
+    tlsf_heap_slab_t slab;
+#endif
+#ifdef TLSF_MALLOC_LATENCY
+    uint32_t lock_start;    /* cycle count when the lock was taken */
+#endif
+} tlsf_heap_t;
+
+#if TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_MUTEX
+#   define TLSF_HEAP_INIT(TLSF) { .tlsf = (TLSF), .lock = MUTEX_INIT }
+#elif TLSF_MALLOC_LOCK == TLSF_MALLOC_LOCK_PTHREAD
+#   define TLSF_HEAP_INIT(TLSF) \
+        { .tlsf = (TLSF), .lock = PTHREAD_MUTEX_INITIALIZER }
+#else
+#   define TLSF_HEAP_INIT(TLSF) { .tlsf = (TLSF) }
+#endif
+
+void tlsf_heap_init(tlsf_heap_t *heap, tlsf_t tlsf);
+
+void *tlsf_heap_malloc(tlsf_heap_t *heap, size_t bytes);
+
+/* Allocate with explicit TLSF_* flags, bypassing front-end caches. */
+void *tlsf_heap_malloc_flags(tlsf_heap_t *heap, size_t bytes, unsigned flags);
+
+/*
+** Tagged allocation, see tlsf_malloc_tagged_ex(). Tagged blocks bypass
+** the front-end caches, so per-tag counts are exact.
+*/
+void *tlsf_heap_malloc_tagged(tlsf_heap_t *heap, unsigned tag, size_t bytes);
+
+void tlsf_heap_set_tag_budget(tlsf_heap_t *heap, unsigned tag, size_t bytes);
+
+size_t tlsf_heap_tag_used(tlsf_heap_t *heap, unsigned tag);
+
+/*
+** Allocate and set *actual to the usable size of the block, or to 0 on
+** failure; the caller may use all of it.
+*/
+void *tlsf_heap_malloc_at_least(tlsf_heap_t *heap, size_t bytes,
+                                size_t *actual);
+
+void *tlsf_heap_calloc(tlsf_heap_t *heap, size_t count, size_t bytes);
+
+void *tlsf_heap_memalign(tlsf_heap_t *heap, size_t align, size_t bytes);
+
+/*
+** Resizes in place or copies to a new block with the heap unlocked; it
+** never moves data down into a free previous block like tlsf_realloc.
+*/
+void *tlsf_heap_realloc(tlsf_heap_t *heap, void *ptr, size_t size);
+
+void tlsf_heap_free(tlsf_heap_t *heap, void *ptr);
+
+/*
+** Free a block of between the requested and the usable size, see
+** tlsf_free_sized_ex(). Sizes above TLSF_MALLOC_SLAB_MAX skip the slab
+** lookup, and sizes beyond the cached classes skip the thread cache.
+*/
+void tlsf_heap_free_sized(tlsf_heap_t *heap, void *ptr, size_t size);
+
+/* Capacity of an allocation, see tlsf_usable_size(). */
+size_t tlsf_heap_usable_size(tlsf_heap_t *heap, void *ptr);
+
+/* Grow an allocation in place, see tlsf_try_expand_ex(). */
+bool tlsf_heap_try_expand(tlsf_heap_t *heap, void *ptr, size_t size);
+
+/*
+** Move an allocation made with tlsf_heap_malloc_flags down into free space,
+** see tlsf_move_down_ex(). Never use this on blocks from the front ends.
+** Unlike tlsf_heap_realloc, this copies the block with the heap locked.
+*/
+void *tlsf_heap_move_down(tlsf_heap_t *heap, void *ptr);
+
+/* Batch operations take the heap lock once and bypass front-end caches. */
+size_t tlsf_heap_malloc_batch(tlsf_heap_t *heap, size_t bytes, size_t count,
+                              void **ptrs);
+
+void tlsf_heap_free_batch(tlsf_heap_t *heap, void **ptrs, size_t count);
+
+/* Run tlsf_check_ex() with the heap locked, see there. */
+int tlsf_heap_check(tlsf_heap_t *heap);
+
+/* Runs with the heap locked for the whole walk over the free lists. */
+void tlsf_heap_fragmentation_report(tlsf_heap_t *heap, tlsf_bucket_t *buckets,
+                                    size_t count, tlsf_fragmentation_t *report);
+
+#ifdef TLSF_STATS
+/* Blocks held in front-end caches count as used. */
+void tlsf_heap_get_stats(tlsf_heap_t *heap, tlsf_stats_t *stats);
+#endif
+
+#ifdef TLSF_RELEASE_HOOKS
+/*
+** See tlsf_set_release_hooks_ex(). The hooks run with the heap locked, in
+** interrupt context for IRQ locking, and must not use the heap.
+*/
+void tlsf_heap_set_release_hooks(tlsf_heap_t *heap, tlsf_release_hook release,
+                                 tlsf_release_hook acquire, size_t granule,
+                                 size_t threshold, void *user);
+#endif
+
+#ifdef TLSF_REMOTE_FREE
+/*
+** Coalesce blocks freed from interrupt context. tlsf_heap_free never takes
+** the heap lock in an ISR but queues the block with tlsf_free_remote_ex.
+*/
+void tlsf_heap_drain(tlsf_heap_t *heap);
+#endif
+
+#ifdef TLSF_MALLOC_CACHE
+/* Return all blocks cached for the calling thread to the heap. */
+void tlsf_heap_cache_flush(tlsf_heap_t *heap);
+#endif
+
+#ifdef TLSF_MALLOC_TRACE
+/*
+** Copy up to count unread trace entries to entries, oldest first, and
+** return how many were copied. *lost is set to the number of entries that
+** were overwritten before they could be read. Only one context may read.
+*/
+size_t tlsf_malloc_trace_read(tlsf_trace_entry_t *entries, size_t count,
+                              uint32_t *lost);
+
+/*
+** Print all unread entries, one "T <op> <size> <align> <ptr> <old> <time>"
+** line each, in the format read by tools/tlsf-replay.c.
+*/
+void tlsf_malloc_trace_dump(void);
+#endif
+
+#ifdef TLSF_MALLOC_LATENCY
+/*
+** Copy the histograms to stats. Calls that finish while they are copied
+** may be missing from some buckets, so the copy is not an atomic snapshot.
+*/
+void tlsf_latency_stats(tlsf_latency_t *stats);
+
+/* Clear the histograms and start the cycle counter if needed. */
+void tlsf_latency_reset(void);
+#endif
+
+/* The heap used by the wrappers below. */
+tlsf_heap_t *tlsf_heap_default(void);
+
+/* Wrappers around the heap of the default TLSF instance. */
 #ifndef TLSF_MALLOC_PREFIX
 #   define TLSF_MALLOC_PREFIX
 #endif
@@ -23,4 +356,12 @@ void *TLSF_MALLOC_NAME(realloc)(void *ptr, size_t size);
 
 void TLSF_MALLOC_NAME(free)(void *ptr);
 
+void TLSF_MALLOC_NAME(free_sized)(void *ptr, size_t size);
+
+size_t TLSF_MALLOC_NAME(malloc_usable_size)(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
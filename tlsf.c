@@ -1,10 +1,16 @@
 #include <assert.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef TLSF_REMOTE_FREE
+#include <stdatomic.h>
+#endif
+
 #include "tlsf.h"
 #include "tlsfbits.h"
 
@@ -12,32 +18,106 @@
 ** Constants.
 */
 
-/* Public constants: may be modified. */
+/*
+** Public constants: may be modified, preferably from the build system:
+** - TLSF_SL_INDEX_COUNT_LOG2: log2 of number of linear subdivisions of
+**   block sizes (up to 6, i.e. 64 second-level lists, which use 64-bit
+**   second-level bitmaps)
+** - TLSF_FL_INDEX_MAX: log2 of the largest block size, keep this close to
+**   the size of the largest pool to shrink the control structure
+** - TLSF_ALIGN_SIZE_LOG2: log2 of the alignment of all sizes and addresses
+** - TLSF_BEST_FIT_SCAN: number of blocks a TLSF_BEST_FIT allocation looks
+**   at in the list of its exact size before the good-fit search
+** - TLSF_ZEROED_POOLS: number of pools added by tlsf_add_zeroed_pool whose
+**   untouched memory is tracked to skip clearing in tlsf_calloc (0: off)
+** - TLSF_CANARY: end every used block with a guard word that is checked
+**   when the block is freed and by tlsf_check_pool
+** - TLSF_TAG_BITS: number of high bits of the size field that hold the
+**   tag of a used block, see tlsf_malloc_tagged (0: off)
+** - TLSF_COMPACT_HEADERS: store block sizes and links in 32 bits, as
+**   offsets from the block itself, which halves the header overhead and
+**   the minimum block size of 64-bit builds. All pools and the control
+**   structure of an instance must then lie within 1 GB of each other.
+** - TLSF_CACHE_LINE_SIZE: align the free list heads of the control
+**   structure to cache lines of this size, which tlsf_create then requires
+**   of its memory (0: off)
+** - TLSF_PREFETCH: prefetch the block headers an allocation is about to
+**   update while the free lists are still being searched
+** - TLSF_QUICK_LISTS: number of the smallest block sizes whose frees are
+**   deferred on exact-size quick lists instead of being coalesced (0: off)
+** - TLSF_QUICK_DEPTH: number of blocks a quick list holds before they are
+**   all coalesced at once
+** - TLSF_RELEASE_HOOKS: report the whole pages, or other granules, of
+**   large free blocks to hooks that can decommit them or power them down,
+**   see tlsf_set_release_hooks
+*/
+#if !defined (TLSF_SL_INDEX_COUNT_LOG2)
+#define TLSF_SL_INDEX_COUNT_LOG2 2
+#endif
+
+#if !defined (TLSF_FL_INDEX_MAX)
+#define TLSF_FL_INDEX_MAX 30
+#endif
+
+#if !defined (TLSF_ALIGN_SIZE_LOG2)
+#define TLSF_ALIGN_SIZE_LOG2 2
+#endif
+
+#if !defined (TLSF_BEST_FIT_SCAN)
+#define TLSF_BEST_FIT_SCAN 8
+#endif
+
+#if !defined (TLSF_ZEROED_POOLS)
+#define TLSF_ZEROED_POOLS 0
+#endif
+
+#if !defined (TLSF_TAG_BITS)
+#define TLSF_TAG_BITS 0
+#endif
+
+#if !defined (TLSF_CACHE_LINE_SIZE)
+#define TLSF_CACHE_LINE_SIZE 0
+#endif
+
+#if !defined (TLSF_QUICK_LISTS)
+#define TLSF_QUICK_LISTS 0
+#endif
+
+#if !defined (TLSF_QUICK_DEPTH)
+#define TLSF_QUICK_DEPTH 8
+#endif
+
+#if defined (TLSF_CANARY)
+#define TLSF_CANARY_SIZE sizeof(size_t)
+#else
+#define TLSF_CANARY_SIZE 0
+#endif
+
 enum tlsf_public
 {
 	/* log2 of number of linear subdivisions of block sizes. */
-	SL_INDEX_COUNT_LOG2 = 2,
+	SL_INDEX_COUNT_LOG2 = TLSF_SL_INDEX_COUNT_LOG2,
 };
 
 /* Private constants: do not modify. */
 enum tlsf_private
 {
-	/* All allocation sizes and addresses are aligned to 4 bytes. */
-#define ALIGN_SIZE_LOG2 (2)
+	/* All allocation sizes and addresses are aligned to ALIGN_SIZE bytes. */
+#define ALIGN_SIZE_LOG2 (TLSF_ALIGN_SIZE_LOG2)
 #define ALIGN_SIZE (1 << ALIGN_SIZE_LOG2)
 
 	/*
 	** We support allocations of sizes up to (1 << FL_INDEX_MAX) bits.
 	** However, because we linearly subdivide the second-level lists, and
-	** our minimum size granularity is 4 bytes, it doesn't make sense to
-	** create first-level lists for sizes smaller than SL_INDEX_COUNT * 4,
-	** or (1 << (SL_INDEX_COUNT_LOG2 + 2)) bytes, as there we will be
-	** trying to split size ranges into more slots than we have available.
-	** Instead, we calculate the minimum threshold size, and place all
-	** blocks below that size into the 0th first-level list.
+	** our minimum size granularity is ALIGN_SIZE bytes, it doesn't make
+	** sense to create first-level lists for sizes smaller than
+	** SL_INDEX_COUNT * ALIGN_SIZE, or (1 << FL_INDEX_SHIFT) bytes, as there
+	** we will be trying to split size ranges into more slots than we have
+	** available. Instead, we calculate the minimum threshold size, and
+	** place all blocks below that size into the 0th first-level list.
 	*/
 
-	FL_INDEX_MAX = 30,
+	FL_INDEX_MAX = TLSF_FL_INDEX_MAX,
 	SL_INDEX_COUNT = (1 << SL_INDEX_COUNT_LOG2),
 	FL_INDEX_SHIFT = (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2),
 	FL_INDEX_COUNT = (FL_INDEX_MAX - FL_INDEX_SHIFT + 1),
@@ -53,6 +133,26 @@ enum tlsf_private
 #define tlsf_min(a, b)		((a) < (b) ? (a) : (b))
 #define tlsf_max(a, b)		((a) > (b) ? (a) : (b))
 
+/*
+** Cache hints. Prefetches are for writing, as the headers that are
+** fetched are all updated by the allocation.
+*/
+#if TLSF_CACHE_LINE_SIZE
+#if defined (__GNUC__)
+#define tlsf_cache_aligned __attribute__((aligned(TLSF_CACHE_LINE_SIZE)))
+#else
+#error "TLSF_CACHE_LINE_SIZE needs a compiler with GCC attributes"
+#endif
+#else
+#define tlsf_cache_aligned
+#endif
+
+#if defined (TLSF_PREFETCH) && defined (__GNUC__)
+#define tlsf_prefetch(addr) __builtin_prefetch((addr), 1)
+#else
+#define tlsf_prefetch(addr) ((void) 0)
+#endif
+
 /*
 ** Set assert macro, if it has not been provided by the user.
 */
@@ -74,8 +174,59 @@ tlsf_static_assert(sizeof(int) * CHAR_BIT == 32);
 tlsf_static_assert(sizeof(size_t) * CHAR_BIT >= 32);
 tlsf_static_assert(sizeof(size_t) * CHAR_BIT <= 64);
 
+/*
+** The second-level bitmaps are as wide as needed for SL_INDEX_COUNT, so
+** finding a list within a first-level range is always a single bit scan.
+*/
+#if TLSF_SL_INDEX_COUNT_LOG2 > 5
+typedef unsigned long long tlsfslmap_t;
+#define tlsf_sl_ffs tlsf_ffs64
+#define tlsf_sl_fls tlsf_fls64
+#else
+typedef unsigned int tlsfslmap_t;
+#define tlsf_sl_ffs tlsf_ffs
+#define tlsf_sl_fls tlsf_fls
+#endif
+
 /* SL_INDEX_COUNT must be <= number of bits in sl_bitmap's storage type. */
-tlsf_static_assert(sizeof(unsigned int) * CHAR_BIT >= SL_INDEX_COUNT);
+tlsf_static_assert(sizeof(tlsfslmap_t) * CHAR_BIT >= SL_INDEX_COUNT);
+
+/* FL_INDEX_COUNT must be <= number of bits in fl_bitmap's storage type. */
+tlsf_static_assert(sizeof(unsigned int) * CHAR_BIT >= FL_INDEX_COUNT);
+
+/*
+** The size field of a block header, and the links between blocks. Compact
+** headers store a link as the signed distance from the block that holds
+** it; TLSF_SIZE_FIELD_LOG2 is needed by the preprocessor to pad headers.
+*/
+#if defined (TLSF_COMPACT_HEADERS)
+typedef uint32_t tlsfsize_t;
+typedef int32_t tlsflink_t;
+#define TLSF_SIZE_FIELD_LOG2 2
+#else
+typedef size_t tlsfsize_t;
+typedef struct block_header_t* tlsflink_t;
+#if defined (TLSF_64BIT)
+#define TLSF_SIZE_FIELD_LOG2 3
+#else
+#define TLSF_SIZE_FIELD_LOG2 2
+#endif
+#endif
+tlsf_static_assert(sizeof(tlsfsize_t) == (1 << TLSF_SIZE_FIELD_LOG2));
+
+/* There must be at least one first-level list above the small blocks. */
+tlsf_static_assert(FL_INDEX_MAX > FL_INDEX_SHIFT);
+tlsf_static_assert(sizeof(tlsfsize_t) * CHAR_BIT > FL_INDEX_MAX);
+
+/* The two low bits of a block size hold the block status. */
+tlsf_static_assert(ALIGN_SIZE_LOG2 >= 2);
+
+/* Quick list lengths are kept in bytes. */
+tlsf_static_assert(TLSF_QUICK_DEPTH > 0 && TLSF_QUICK_DEPTH < 256);
+
+/* Tags live above the largest block size; lower TLSF_FL_INDEX_MAX for more. */
+tlsf_static_assert(TLSF_TAG_BITS < 16);
+tlsf_static_assert(sizeof(tlsfsize_t) * CHAR_BIT >= FL_INDEX_MAX + TLSF_TAG_BITS);
 
 /* Ensure we've properly tuned our sizes. */
 tlsf_static_assert(ALIGN_SIZE == SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
@@ -93,18 +244,25 @@ tlsf_static_assert(ALIGN_SIZE == SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
 **   previous block. It appears at the beginning of this structure only to
 **   simplify the implementation.
 ** - The next_free / prev_free fields are only valid if the block is free.
+** - If ALIGN_SIZE is larger than the size field, it is padded so user
+**   data, which starts at next_free, stays ALIGN_SIZE aligned.
+** - The links are only accessed through the block_*_link functions, which
+**   convert them from and to compact headers' offsets.
 */
 typedef struct block_header_t
 {
 	/* Points to the previous physical block. */
-	struct block_header_t* prev_phys_block;
+	tlsflink_t prev_phys_block;
 
 	/* The size of this block, excluding the block header. */
-	size_t size;
+	tlsfsize_t size;
+#if ALIGN_SIZE_LOG2 > TLSF_SIZE_FIELD_LOG2
+	unsigned char size_pad[(1 << ALIGN_SIZE_LOG2) - sizeof(tlsfsize_t)];
+#endif
 
 	/* Next and previous free blocks. */
-	struct block_header_t* next_free;
-	struct block_header_t* prev_free;
+	tlsflink_t next_free;
+	tlsflink_t prev_free;
 } block_header_t;
 
 /*
@@ -117,46 +275,153 @@ static const size_t block_header_free_bit = 1 << 0;
 static const size_t block_header_prev_free_bit = 1 << 1;
 
 /*
-** The size of the block header exposed to used blocks is the size field.
-** The prev_phys_block field is stored *inside* the previous free block.
+** With TLSF_TAG_BITS, the top bits of the size field hold the tag of a
+** used block. They are not cleared when a block is freed or split, so the
+** tag of a free block is meaningless and is set when it is handed out.
+*/
+#if TLSF_TAG_BITS
+#define TLSF_TAG_COUNT (1 << TLSF_TAG_BITS)
+static const int block_header_tag_shift = sizeof(tlsfsize_t) * CHAR_BIT - TLSF_TAG_BITS;
+static const size_t block_header_tag_mask =
+	tlsf_cast(size_t, TLSF_TAG_COUNT - 1) << (sizeof(tlsfsize_t) * CHAR_BIT - TLSF_TAG_BITS);
+#else
+#define TLSF_TAG_COUNT 1
+static const size_t block_header_tag_mask = 0;
+#endif
+
+/*
+** The size of the block header exposed to used blocks is the size field,
+** including its padding. The prev_phys_block field is stored *inside* the
+** previous free block.
 */
-static const size_t block_header_overhead = sizeof(size_t);
+static const size_t block_header_overhead =
+	offsetof(block_header_t, next_free) - offsetof(block_header_t, size);
 
 /* User data starts directly after the size field in a used block. */
-static const size_t block_start_offset =
-	offsetof(block_header_t, size) + sizeof(size_t);
+static const size_t block_start_offset = offsetof(block_header_t, next_free);
 
 /*
-** A free block must be large enough to store its header minus the size of
-** the prev_phys_block field, and no larger than the number of addressable
-** bits for FL_INDEX.
+** A free block must be large enough to store its free list links and the
+** prev_phys_block field of the next block, and no larger than the number
+** of addressable bits for FL_INDEX.
 */
 static const size_t block_size_min =
-	sizeof(block_header_t) - sizeof(block_header_t*);
+	(sizeof(block_header_t) - offsetof(block_header_t, next_free)
+	+ sizeof(tlsflink_t) + (ALIGN_SIZE - 1)) & ~(ALIGN_SIZE - 1);
 static const size_t block_size_max = tlsf_cast(size_t, 1) << FL_INDEX_MAX;
 
+/* Consecutive blocks must keep user data aligned. */
+tlsf_static_assert((offsetof(block_header_t, next_free)
+	- offsetof(block_header_t, size)) % ALIGN_SIZE == 0);
+
+
+#if TLSF_ZEROED_POOLS
+/*
+** A pool that was zero when it was added. Memory at and above clean has
+** never been handed out, so it is still zero apart from the header of the
+** free block that starts there and the link to the sentinel at the end.
+*/
+typedef struct zeroed_pool_t
+{
+	char* start;
+	char* end;
+	char* clean;
+} zeroed_pool_t;
+#endif
 
-/* The TLSF control structure. */
+/*
+** The TLSF control structure. The fields every allocation reads come
+** first, so that they share as few cache lines as possible. Rows of the
+** free list heads are a power of two in size, so with TLSF_CACHE_LINE_SIZE
+** none of them straddles a line.
+*/
 typedef struct control_t
 {
+	/* Bitmaps for free lists. */
+	unsigned int fl_bitmap;
+
+	/* Allocation flags used when the caller does not pass any. */
+	unsigned int flags;
+
 	/* Empty lists point at this block to indicate they are free. */
 	block_header_t block_null;
 
-	/* Bitmaps for free lists. */
-	unsigned int fl_bitmap;
-	unsigned int sl_bitmap[FL_INDEX_COUNT];
+	tlsfslmap_t sl_bitmap[FL_INDEX_COUNT];
 
 	/* Head of free lists. */
-	block_header_t* blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
+	block_header_t* blocks[FL_INDEX_COUNT][SL_INDEX_COUNT] tlsf_cache_aligned;
+
+#ifdef TLSF_REMOTE_FREE
+	/* Used blocks freed by tlsf_free_remote, linked through next_free. */
+	block_header_t* _Atomic remote_free;
+#endif
+
+#if TLSF_QUICK_LISTS
+	/*
+	** Freed blocks of the smallest sizes that are still marked as used,
+	** linked through next_free, and the number of blocks on each list.
+	*/
+	block_header_t* quick[TLSF_QUICK_LISTS];
+	unsigned char quick_count[TLSF_QUICK_LISTS];
+	unsigned int quick_total;
+#endif
+
+#ifdef TLSF_STATS
+	/* Bytes in pools and used blocks, both including block headers. */
+	size_t stats_total;
+	size_t stats_used;
+	size_t stats_peak;
+	size_t stats_count;
+#endif
+
+#if TLSF_ZEROED_POOLS
+	/* Pools added by tlsf_add_zeroed_pool; unused entries have no start. */
+	zeroed_pool_t zeroed[TLSF_ZEROED_POOLS];
+#endif
+
+#if TLSF_TAG_BITS
+	/* Bytes in used blocks of each tag, including headers; 0 budget: none. */
+	size_t tag_used[TLSF_TAG_COUNT];
+	size_t tag_budget[TLSF_TAG_COUNT];
+#endif
+
+#if defined (TLSF_RELEASE_HOOKS)
+	/* Hooks for the granules of free blocks; granule 0: none. */
+	tlsf_release_hook release_hook;
+	tlsf_release_hook acquire_hook;
+	void* hook_user;
+	size_t hook_granule;
+	size_t hook_threshold;
+#endif
 } control_t;
 
-static control_t *control;
 /* A type used for casting when doing pointer arithmetic. */
 typedef ptrdiff_t tlsfptr_t;
 
-#ifdef DEVELHELP
-void *default_pool;
-#endif
+/* Instance used by the functions that do not take a tlsf_t handle. */
+static control_t* default_control;
+
+/*
+** Error reporting, shared by all instances since tlsf_create reports
+** errors before there is one.
+*/
+static void default_error_handler(const char* format, va_list args)
+{
+	vprintf(format, args);
+}
+
+static tlsf_error_handler error_handler = default_error_handler;
+
+static void tlsf_error(const char* format, ...)
+{
+	if (error_handler)
+	{
+		va_list args;
+		va_start(args, format);
+		error_handler(format, args);
+		va_end(args);
+	}
+}
 
 /*
 ** block_header_t member functions.
@@ -164,14 +429,32 @@ void *default_pool;
 
 static size_t block_size(const block_header_t* block)
 {
-	return block->size & ~(block_header_free_bit | block_header_prev_free_bit);
+	return block->size & ~(block_header_free_bit | block_header_prev_free_bit
+		| block_header_tag_mask);
 }
 
 static void block_set_size(block_header_t* block, size_t size)
 {
 	const size_t oldsize = block->size;
-	block->size = size | (oldsize & (block_header_free_bit | block_header_prev_free_bit));
+	block->size = tlsf_cast(tlsfsize_t, size | (oldsize & (block_header_free_bit
+		| block_header_prev_free_bit | block_header_tag_mask)));
+}
+
+#if TLSF_TAG_BITS
+static unsigned int block_tag(const block_header_t* block)
+{
+	return tlsf_cast(unsigned int, block->size >> block_header_tag_shift);
+}
+
+static void block_set_tag(block_header_t* block, unsigned int tag)
+{
+	block->size = tlsf_cast(tlsfsize_t, (block->size & ~block_header_tag_mask)
+		| (tlsf_cast(size_t, tag) << block_header_tag_shift));
 }
+#else
+#define block_tag(block) (0U)
+#define block_set_tag(block, tag) ((void) (tag))
+#endif
 
 static int block_is_last(const block_header_t* block)
 {
@@ -226,17 +509,63 @@ static block_header_t* offset_to_block(const void* ptr, size_t size)
 	return tlsf_cast(block_header_t*, tlsf_cast(tlsfptr_t, ptr) + size);
 }
 
+#if defined (TLSF_COMPACT_HEADERS)
+static block_header_t* block_from_link(const block_header_t* block, tlsflink_t link)
+{
+	return tlsf_cast(block_header_t*, tlsf_cast(tlsfptr_t, block) + link);
+}
+
+static tlsflink_t block_to_link(const block_header_t* block, const block_header_t* target)
+{
+	const tlsfptr_t link = tlsf_cast(tlsfptr_t, target) - tlsf_cast(tlsfptr_t, block);
+	tlsf_assert(link == tlsf_cast(tlsflink_t, link) && "block out of link range");
+	return tlsf_cast(tlsflink_t, link);
+}
+
+/* Links must reach the control structure and every other pool from mem. */
+static int control_links_reach(const void* control, const void* mem, size_t bytes)
+{
+	const tlsfptr_t range = tlsf_cast(tlsfptr_t, 1) << 30;
+	const tlsfptr_t start = tlsf_cast(tlsfptr_t, mem) - tlsf_cast(tlsfptr_t, control);
+	return start >= -range && start <= range && bytes <= tlsf_cast(size_t, range - start);
+}
+#else
+#define block_from_link(block, link) (link)
+#define block_to_link(block, target) (target)
+#define control_links_reach(control, mem, bytes) (1)
+#endif
+
+static block_header_t* block_next_free_link(const block_header_t* block)
+{
+	return block_from_link(block, block->next_free);
+}
+
+static block_header_t* block_prev_free_link(const block_header_t* block)
+{
+	return block_from_link(block, block->prev_free);
+}
+
+static void block_set_next_free_link(block_header_t* block, block_header_t* next)
+{
+	block->next_free = block_to_link(block, next);
+}
+
+static void block_set_prev_free_link(block_header_t* block, block_header_t* prev)
+{
+	block->prev_free = block_to_link(block, prev);
+}
+
 /* Return location of previous block. */
 static block_header_t* block_prev(const block_header_t* block)
 {
-	return block->prev_phys_block;
+	return block_from_link(block, block->prev_phys_block);
 }
 
 /* Return location of next existing block. */
 static block_header_t* block_next(const block_header_t* block)
 {
-	block_header_t* next = offset_to_block(block_to_ptr(block),
-		block_size(block) - block_header_overhead);
+	block_header_t* next = offset_to_block(block,
+		block_size(block) + block_header_overhead);
 	tlsf_assert(!block_is_last(block));
 	return next;
 }
@@ -245,7 +574,7 @@ static block_header_t* block_next(const block_header_t* block)
 static block_header_t* block_link_next(block_header_t* block)
 {
 	block_header_t* next = block_next(block);
-	next->prev_phys_block = block;
+	next->prev_phys_block = block_to_link(next, block);
 	return next;
 }
 
@@ -264,6 +593,99 @@ static void block_mark_as_used(block_header_t* block)
 	block_set_used(block);
 }
 
+#if defined (TLSF_STATS) || TLSF_TAG_BITS
+/* Account for a block being handed out to the user, after it is tagged. */
+static void control_count_used(control_t* control, const block_header_t* block)
+{
+#ifdef TLSF_STATS
+	control->stats_used += block_size(block) + block_header_overhead;
+	control->stats_peak = tlsf_max(control->stats_peak, control->stats_used);
+	++control->stats_count;
+#endif
+#if TLSF_TAG_BITS
+	control->tag_used[block_tag(block)] += block_size(block) + block_header_overhead;
+#endif
+}
+
+/* Account for a block being returned by the user. */
+static void control_count_free(control_t* control, const block_header_t* block)
+{
+#ifdef TLSF_STATS
+	control->stats_used -= block_size(block) + block_header_overhead;
+	--control->stats_count;
+#endif
+#if TLSF_TAG_BITS
+	control->tag_used[block_tag(block)] -= block_size(block) + block_header_overhead;
+#endif
+}
+#else
+#define control_count_used(control, block) ((void) (control))
+#define control_count_free(control, block) ((void) (control))
+#endif
+
+#if TLSF_TAG_BITS
+/* Whether a tag may take another bytes of blocks, headers included. */
+static int control_in_budget(const control_t* control, unsigned int tag, size_t bytes)
+{
+	const size_t budget = control->tag_budget[tag];
+	return !budget || control->tag_used[tag] + bytes <= budget;
+}
+#else
+#define control_in_budget(control, tag, bytes) (1)
+#endif
+
+#if TLSF_ZEROED_POOLS
+static zeroed_pool_t* control_zeroed_pool(control_t* control, const void* ptr)
+{
+	int i;
+	for (i = 0; i < TLSF_ZEROED_POOLS; ++i)
+	{
+		zeroed_pool_t* pool = &control->zeroed[i];
+		if (pool->start
+			&& tlsf_cast(tlsfptr_t, ptr) >= tlsf_cast(tlsfptr_t, pool->start)
+			&& tlsf_cast(tlsfptr_t, ptr) < tlsf_cast(tlsfptr_t, pool->end))
+		{
+			return pool;
+		}
+	}
+	return 0;
+}
+
+/* Move the clean boundary of a zeroed pool past a block handed out. */
+static void control_touch(control_t* control, const block_header_t* block)
+{
+	zeroed_pool_t* pool = control_zeroed_pool(control, block_to_ptr(block));
+	if (pool)
+	{
+		char* end = tlsf_cast(char*, block_to_ptr(block)) + block_size(block);
+		if (tlsf_cast(tlsfptr_t, end) > tlsf_cast(tlsfptr_t, pool->clean))
+		{
+			pool->clean = end;
+		}
+	}
+}
+
+/* Number of leading bytes of a new allocation that may not be zero. */
+static size_t control_dirty_size(control_t* control, const void* ptr, size_t size)
+{
+	const zeroed_pool_t* pool = control_zeroed_pool(control, ptr);
+	const char* start = tlsf_cast(const char*, ptr);
+	const char* clean;
+
+	/* The last word of the pool links the sentinel block. */
+	if (!pool || tlsf_cast(size_t, pool->end - start) < size + sizeof(block_header_t))
+	{
+		return size;
+	}
+
+	clean = pool->clean + sizeof(block_header_t);
+	return (clean <= start) ? 0 : tlsf_min(size, tlsf_cast(size_t, clean - start));
+}
+#else
+#define control_touch(control, block) ((void) 0)
+#define control_dirty_size(control, ptr, size) (size)
+#endif
+
 static size_t align_up(size_t x, size_t align)
 {
 	tlsf_assert(0 == (align & (align - 1)) && "must align to a power of two");
@@ -291,9 +713,9 @@ static void* align_ptr(const void* ptr, size_t align)
 static size_t adjust_request_size(size_t size, size_t align)
 {
 	size_t adjust = 0;
-	if (size && size < block_size_max)
+	if (size && size < block_size_max - TLSF_CANARY_SIZE)
 	{
-		const size_t aligned = align_up(size, align);
+		const size_t aligned = align_up(size + TLSF_CANARY_SIZE, align);
 		adjust = tlsf_max(aligned, block_size_min);
 	}
 	return adjust;
@@ -326,15 +748,31 @@ static void mapping_insert(size_t size, int* fli, int* sli)
 /* This version rounds up to the next block size (for allocations) */
 static void mapping_search(size_t size, int* fli, int* sli)
 {
-	if (size >= (1 << SL_INDEX_COUNT_LOG2))
+	if (size >= SMALL_BLOCK_SIZE)
 	{
-		const size_t round = (1 << (tlsf_fls_sizet(size) - SL_INDEX_COUNT_LOG2)) - 1;
+		const size_t round = (tlsf_cast(size_t, 1) << (tlsf_fls_sizet(size) - SL_INDEX_COUNT_LOG2)) - 1;
 		size += round;
 	}
 	mapping_insert(size, fli, sli);
 }
 
-static block_header_t* search_suitable_block(int* fli, int* sli)
+/* Return the smallest block size stored in the list for the given indices. */
+static size_t mapping_size(int fl, int sl)
+{
+	size_t size;
+	if (fl == 0)
+	{
+		size = tlsf_cast(size_t, sl) * (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+	}
+	else
+	{
+		const int shift = fl + FL_INDEX_SHIFT - 1 - SL_INDEX_COUNT_LOG2;
+		size = tlsf_cast(size_t, SL_INDEX_COUNT + sl) << shift;
+	}
+	return size;
+}
+
+static block_header_t* search_suitable_block(control_t* control, int* fli, int* sli)
 {
 	int fl = *fli;
 	int sl = *sli;
@@ -343,7 +781,7 @@ static block_header_t* search_suitable_block(int* fli, int* sli)
 	** First, search for a block in the list associated with the given
 	** fl/sl index.
 	*/
-	unsigned int sl_map = control->sl_bitmap[fl] & (((unsigned int)~0) << sl);
+	tlsfslmap_t sl_map = control->sl_bitmap[fl] & (((tlsfslmap_t)~0) << sl);
 	if (!sl_map)
 	{
 		/* No block exists. Search in the next largest first-level list. */
@@ -359,22 +797,53 @@ static block_header_t* search_suitable_block(int* fli, int* sli)
 		sl_map = control->sl_bitmap[fl];
 	}
 	tlsf_assert(sl_map && "internal error - second level bitmap is null");
-	sl = tlsf_ffs(sl_map);
+	sl = tlsf_sl_ffs(sl_map);
 	*sli = sl;
 
 	/* Return the first block in the free list. */
 	return control->blocks[fl][sl];
 }
 
+/*
+** Look for a block of at least the given size in the list that the size
+** itself maps to, which search_suitable_block skips because not all of its
+** blocks fit. Returns the smallest fitting block among the first
+** TLSF_BEST_FIT_SCAN ones, so the cost stays bounded.
+*/
+static block_header_t* search_exact_block(control_t* control, size_t size, int* fli, int* sli)
+{
+	block_header_t* best = 0;
+	block_header_t* block;
+	int scan = TLSF_BEST_FIT_SCAN;
+
+	mapping_insert(size, fli, sli);
+	block = control->blocks[*fli][*sli];
+
+	for (; scan-- && block != &control->block_null; block = block_next_free_link(block))
+	{
+		const size_t candidate = block_size(block);
+		if (candidate >= size && (!best || candidate < block_size(best)))
+		{
+			best = block;
+			if (candidate == size)
+			{
+				break;
+			}
+		}
+	}
+
+	return best;
+}
+
 /* Remove a free block from the free list.*/
-static void remove_free_block(block_header_t* block, int fl, int sl)
+static void remove_free_block(control_t* control, block_header_t* block, int fl, int sl)
 {
-	block_header_t* prev = block->prev_free;
-	block_header_t* next = block->next_free;
+	block_header_t* prev = block_prev_free_link(block);
+	block_header_t* next = block_next_free_link(block);
 	tlsf_assert(prev && "prev_free field can not be null");
 	tlsf_assert(next && "next_free field can not be null");
-	next->prev_free = prev;
-	prev->next_free = next;
+	block_set_prev_free_link(next, prev);
+	block_set_next_free_link(prev, next);
 
 	/* If this block is the head of the free list, set new head. */
 	if (control->blocks[fl][sl] == block)
@@ -384,26 +853,26 @@ static void remove_free_block(block_header_t* block, int fl, int sl)
 		/* If the new head is null, clear the bitmap. */
 		if (next == &control->block_null)
 		{
-			control->sl_bitmap[fl] &= ~(1 << sl);
+			control->sl_bitmap[fl] &= ~(tlsf_cast(tlsfslmap_t, 1) << sl);
 
 			/* If the second bitmap is now empty, clear the fl bitmap. */
 			if (!control->sl_bitmap[fl])
 			{
-				control->fl_bitmap &= ~(1 << fl);
+				control->fl_bitmap &= ~(1U << fl);
 			}
 		}
 	}
 }
 
 /* Insert a free block into the free block list. */
-static void insert_free_block(block_header_t* block, int fl, int sl)
+static void insert_free_block(control_t* control, block_header_t* block, int fl, int sl)
 {
 	block_header_t* current = control->blocks[fl][sl];
 	tlsf_assert(current && "free list cannot have a null entry");
 	tlsf_assert(block && "cannot insert a null entry into the free list");
-	block->next_free = current;
-	block->prev_free = &control->block_null;
-	current->prev_free = block;
+	block_set_next_free_link(block, current);
+	block_set_prev_free_link(block, &control->block_null);
+	block_set_prev_free_link(current, block);
 
 	tlsf_assert(block_to_ptr(block) == align_ptr(block_to_ptr(block), ALIGN_SIZE)
 		&& "block not aligned properly");
@@ -412,29 +881,29 @@ static void insert_free_block(block_header_t* block, int fl, int sl)
 	** and second-level bitmaps appropriately.
 	*/
 	control->blocks[fl][sl] = block;
-	control->fl_bitmap |= (1 << fl);
-	control->sl_bitmap[fl] |= (1 << sl);
+	control->fl_bitmap |= (1U << fl);
+	control->sl_bitmap[fl] |= (tlsf_cast(tlsfslmap_t, 1) << sl);
 }
 
 /* Remove a given block from the free list. */
-static void block_remove(block_header_t* block)
+static void block_remove(control_t* control, block_header_t* block)
 {
 	int fl, sl;
 	mapping_insert(block_size(block), &fl, &sl);
-	remove_free_block(block, fl, sl);
+	remove_free_block(control, block, fl, sl);
 }
 
 /* Insert a given block into the free list. */
-static void block_insert(block_header_t* block)
+static void block_insert(control_t* control, block_header_t* block)
 {
 	int fl, sl;
 	mapping_insert(block_size(block), &fl, &sl);
-	insert_free_block(block, fl, sl);
+	insert_free_block(control, block, fl, sl);
 }
 
 static int block_can_split(block_header_t* block, size_t size)
 {
-	return block_size(block) >= sizeof(block_header_t) + size;
+	return block_size(block) >= size + block_header_overhead + block_size_min;
 }
 
 /* Split a block into two, the second of which is free. */
@@ -442,7 +911,7 @@ static block_header_t* block_split(block_header_t* block, size_t size)
 {
 	/* Calculate the amount of space left in the remaining block. */
 	block_header_t* remaining =
-		offset_to_block(block_to_ptr(block), size - block_header_overhead);
+		offset_to_block(block, size + block_header_overhead);
 
 	const size_t remain_size = block_size(block) - (size + block_header_overhead);
 
@@ -470,14 +939,14 @@ static block_header_t* block_absorb(block_header_t* prev, block_header_t* block)
 }
 
 /* Merge a just-freed block with an adjacent previous free block. */
-static block_header_t* block_merge_prev(block_header_t* block)
+static block_header_t* block_merge_prev(control_t* control, block_header_t* block)
 {
 	if (block_is_prev_free(block))
 	{
 		block_header_t* prev = block_prev(block);
 		tlsf_assert(prev && "prev physical block can't be null");
 		tlsf_assert(block_is_free(prev) && "prev block is not free though marked as such");
-		block_remove(prev);
+		block_remove(control, prev);
 		block = block_absorb(prev, block);
 	}
 
@@ -485,7 +954,7 @@ static block_header_t* block_merge_prev(block_header_t* block)
 }
 
 /* Merge a just-freed block with an adjacent free block. */
-static block_header_t* block_merge_next(block_header_t* block)
+static block_header_t* block_merge_next(control_t* control, block_header_t* block)
 {
 	block_header_t* next = block_next(block);
 	tlsf_assert(next && "next physical block can't be null");
@@ -493,98 +962,483 @@ static block_header_t* block_merge_next(block_header_t* block)
 	if (block_is_free(next))
 	{
 		tlsf_assert(!block_is_last(block) && "previous block can't be last!");
-		block_remove(next);
+		block_remove(control, next);
 		block = block_absorb(block, next);
 	}
 
 	return block;
 }
 
+#if defined (TLSF_RELEASE_HOOKS)
+/*
+** The released part of a free block spanning [start, end), from its own
+** header to the header of the next block: the whole granules between the
+** two, if they add up to the threshold. Free blocks in the lists have
+** their released part passed to the release hook, and the acquire hook
+** gets it back before anything is written there. A piece of a free block
+** never has more released than the whole, so when blocks are split or
+** merged only the difference is passed to the hooks.
+*/
+typedef struct release_span_t
+{
+	char* lo;
+	char* hi;
+} release_span_t;
+
+static release_span_t control_released(const control_t* control,
+	const void* start, const void* end)
+{
+	const size_t granule = control->hook_granule;
+	release_span_t span = { 0, 0 };
+
+	if (granule)
+	{
+		char* lo = tlsf_cast(char*, align_ptr(
+			tlsf_cast(const char*, start) + sizeof(block_header_t), granule));
+		char* hi = tlsf_cast(char*, end) - (tlsf_cast(tlsfptr_t, end) & (granule - 1));
+		if (lo < hi && tlsf_cast(size_t, hi - lo) >= control->hook_threshold)
+		{
+			span.lo = lo;
+			span.hi = hi;
+		}
+	}
+	return span;
+}
+
+/* Pass what is in span but in neither a nor b, both within and in order, to hook. */
+static void control_notify(const control_t* control, tlsf_release_hook hook,
+	release_span_t span, release_span_t a, release_span_t b)
+{
+	char* lo = span.lo;
+
+	if (!hook || lo == span.hi)
+	{
+		return;
+	}
+	if (a.lo != a.hi)
+	{
+		if (a.lo > lo)
+		{
+			hook(lo, tlsf_cast(size_t, a.lo - lo), control->hook_user);
+		}
+		lo = a.hi;
+	}
+	if (b.lo != b.hi)
+	{
+		if (b.lo > lo)
+		{
+			hook(lo, tlsf_cast(size_t, b.lo - lo), control->hook_user);
+		}
+		lo = b.hi;
+	}
+	if (span.hi > lo)
+	{
+		hook(lo, tlsf_cast(size_t, span.hi - lo), control->hook_user);
+	}
+}
+
+/*
+** Release a free block that was used memory in [lo, hi) before; what it
+** merged below lo and from hi on was free and released before.
+*/
+static void control_release(control_t* control, block_header_t* block,
+	const void* lo, const void* hi)
+{
+	const void* end = block_next(block);
+	control_notify(control, control->release_hook,
+		control_released(control, block, end),
+		control_released(control, block, lo),
+		control_released(control, hi, end));
+}
+
+/*
+** Acquire a free block that is about to be written, except for the parts
+** below mid and from rest on, which stay free.
+*/
+static void control_acquire(control_t* control, block_header_t* block,
+	const void* mid, const void* rest)
+{
+	const void* end = block_next(block);
+	control_notify(control, control->acquire_hook,
+		control_released(control, block, end),
+		control_released(control, block, mid),
+		control_released(control, rest, end));
+}
+
+/* Pass the released parts of all free blocks to hook. */
+static void control_notify_all(control_t* control, tlsf_release_hook hook)
+{
+	const release_span_t none = { 0, 0 };
+	int i, j;
+
+	for (i = 0; i < FL_INDEX_COUNT; ++i)
+	{
+		for (j = 0; j < SL_INDEX_COUNT; ++j)
+		{
+			block_header_t* block = control->blocks[i][j];
+			while (block != &control->block_null)
+			{
+				control_notify(control, hook,
+					control_released(control, block, block_next(block)), none, none);
+				block = block_next_free_link(block);
+			}
+		}
+	}
+}
+#else
+#define control_release(control, block, lo, hi) ((void) (lo), (void) (hi))
+#define control_acquire(control, block, mid, rest) ((void) (mid), (void) (rest))
+#endif
+
 /* Trim any trailing block space off the end of a block, return to pool. */
-static void block_trim_free(block_header_t* block, size_t size)
+static void block_trim_free(control_t* control, block_header_t* block, size_t size)
 {
 	tlsf_assert(block_is_free(block) && "block must be free");
 	if (block_can_split(block, size))
 	{
-		block_header_t* remaining_block = block_split(block, size);
+		block_header_t* remaining_block;
+		control_acquire(control, block, block, offset_to_block(block, size + block_header_overhead));
+		remaining_block = block_split(block, size);
 		block_link_next(block);
 		block_set_prev_free(remaining_block);
-		block_insert(remaining_block);
+		block_insert(control, remaining_block);
+	}
+	else
+	{
+		control_acquire(control, block, block, block_next(block));
 	}
 }
 
-/* Trim any trailing block space off the end of a used block, return to pool. */
-static void block_trim_used(block_header_t* block, size_t size)
+/*
+** Trim any trailing block space off the end of a used block, return to
+** pool. If released is set, that space was taken from a free block
+** without being acquired.
+*/
+static void block_trim_used(control_t* control, block_header_t* block, size_t size,
+	int released)
 {
 	tlsf_assert(!block_is_free(block) && "block must be used");
 	if (block_can_split(block, size))
 	{
 		/* If the next block is free, we must coalesce. */
 		block_header_t* remaining_block = block_split(block, size);
+		block_header_t* next = block_next(remaining_block);
 		block_set_prev_used(remaining_block);
 
-		remaining_block = block_merge_next(remaining_block);
-		block_insert(remaining_block);
+		remaining_block = block_merge_next(control, remaining_block);
+		block_insert(control, remaining_block);
+		control_release(control, remaining_block, released ? next : remaining_block, next);
 	}
 }
 
-static block_header_t* block_trim_free_leading(block_header_t* block, size_t size)
+static block_header_t* block_trim_free_leading(control_t* control, block_header_t* block, size_t size)
 {
 	block_header_t* remaining_block = block;
-	if (block_can_split(block, size))
+
+	/*
+	** Unlike block_can_split, size includes the header of the 2nd block;
+	** the caller makes sure the 2nd block can hold its allocation.
+	*/
+	if (block_size(block) >= size + block_size_min)
 	{
+		/* Only the header of the 2nd block is written here. */
+		control_acquire(control, block, offset_to_block(block, size),
+			offset_to_block(block, size));
+
 		/* We want the 2nd block. */
 		remaining_block = block_split(block, size - block_header_overhead);
 		block_set_prev_free(remaining_block);
 
 		block_link_next(block);
-		block_insert(block);
+		block_insert(control, block);
 	}
 
 	return remaining_block;
 }
 
-static block_header_t* block_locate_free(size_t size)
+#ifdef TLSF_CANARY
+/*
+** The guard word takes the last word of a used block, which is where the
+** next block keeps its prev_phys_block link while this block is free. It
+** is rewritten whenever a used block changes its size.
+*/
+static size_t block_canary_value(const block_header_t* block)
 {
-	int fl = 0, sl = 0;
-	block_header_t* block = 0;
+	return tlsf_cast(size_t, 0x5afec0deUL) ^ tlsf_cast(size_t, tlsf_cast(tlsfptr_t, block));
+}
 
-	if (size)
-	{
-		mapping_search(size, &fl, &sl);
-		block = search_suitable_block(&fl, &sl);
-	}
+static void* block_canary(const block_header_t* block)
+{
+	return tlsf_cast(char*, block_to_ptr(block)) + block_size(block) - TLSF_CANARY_SIZE;
+}
+
+static void block_set_canary(block_header_t* block)
+{
+	const size_t value = block_canary_value(block);
+	memcpy(block_canary(block), &value, sizeof(value));
+}
+
+static int block_canary_ok(const block_header_t* block)
+{
+	size_t value;
+	memcpy(&value, block_canary(block), sizeof(value));
+	return value == block_canary_value(block);
+}
+
+/* Report a damaged block; it is not freed, to not spread the damage. */
+static int block_check_canary(const block_header_t* block)
+{
+	if (!block_canary_ok(block))
+	{
+		tlsf_error("tlsf_free: heap corruption detected at %p, block not freed.\n",
+			block_to_ptr(block));
+		tlsf_assert(0 && "heap corruption detected");
+		return 0;
+	}
+	return 1;
+}
+#else
+#define block_set_canary(block) ((void) 0)
+#define block_canary_ok(block) (1)
+#define block_check_canary(block) (1)
+#endif
+
+/* Coalesce a used block that has already been accounted as freed. */
+static void block_release(control_t* control, block_header_t* block)
+{
+	block_header_t* const used = block;
+	block_header_t* next;
+
+	block_mark_as_free(block);
+	next = block_next(block);
+	block = block_merge_prev(control, block);
+	block = block_merge_next(control, block);
+	block_insert(control, block);
+	control_release(control, block, used, next);
+}
+
+static void block_free(control_t* control, block_header_t* block)
+{
+	tlsf_assert(!block_is_free(block) && "block already marked as free");
+	if (!block_check_canary(block))
+	{
+		return;
+	}
+	control_count_free(control, block);
+	block_release(control, block);
+}
+
+#if TLSF_QUICK_LISTS
+/* Quick list for a block size, or -1 if its frees are not deferred. */
+static int quick_index(size_t size)
+{
+	const size_t index = (size - block_size_min) / ALIGN_SIZE;
+	return (size >= block_size_min && index < TLSF_QUICK_LISTS) ? tlsf_cast(int, index) : -1;
+}
+
+/* Coalesce all blocks of a quick list, at most TLSF_QUICK_DEPTH. */
+static void control_flush_quick(control_t* control, int index)
+{
+	block_header_t* block = control->quick[index];
+
+	control->quick_total -= control->quick_count[index];
+	for (; control->quick_count[index]; --control->quick_count[index])
+	{
+		block_header_t* next = block_next_free_link(block);
+		block_release(control, block);
+		block = next;
+	}
+	control->quick[index] = 0;
+}
+
+static void control_flush_all_quick(control_t* control)
+{
+	int i;
+	for (i = 0; control->quick_total && i < TLSF_QUICK_LISTS; ++i)
+	{
+		control_flush_quick(control, i);
+	}
+}
+
+/*
+** Free a small block onto its quick list, leaving it marked as used so
+** that its neighbours do not merge with it. Returns 0 for other blocks.
+** The end of a list is a self link, as with the remote free queue.
+*/
+static int block_free_quick(control_t* control, block_header_t* block)
+{
+	const int index = quick_index(block_size(block));
+
+	if (index < 0)
+	{
+		return 0;
+	}
+	tlsf_assert(!block_is_free(block) && "block already marked as free");
+	if (block_check_canary(block))
+	{
+		control_count_free(control, block);
+		if (control->quick_count[index] == TLSF_QUICK_DEPTH)
+		{
+			control_flush_quick(control, index);
+		}
+		block_set_next_free_link(block,
+			control->quick_count[index] ? control->quick[index] : block);
+		control->quick[index] = block;
+		++control->quick_count[index];
+		++control->quick_total;
+	}
+	return 1;
+}
+
+/* Take a block of exactly the given size off its quick list. */
+static block_header_t* control_pop_quick(control_t* control, size_t size)
+{
+	const int index = quick_index(size);
+	block_header_t* block = 0;
+
+	if (index >= 0 && control->quick_count[index])
+	{
+		block = control->quick[index];
+		control->quick[index] = block_next_free_link(block);
+		--control->quick_count[index];
+		--control->quick_total;
+	}
+	return block;
+}
+#else
+#define control_flush_all_quick(control) ((void) (control))
+#define block_free_quick(control, block) (0)
+#define control_pop_quick(control, size) ((block_header_t*) 0)
+#endif
+
+#ifdef TLSF_REMOTE_FREE
+/* Coalesce all blocks queued by tlsf_free_remote. */
+static void control_drain(control_t* control)
+{
+	block_header_t* block = atomic_exchange_explicit(&control->remote_free,
+		0, memory_order_acquire);
+
+	/* The last queued block links to itself, see tlsf_free_remote_ex. */
+	while (block)
+	{
+		block_header_t* next = block_next_free_link(block);
+		block_free(control, block);
+		block = (next == block) ? 0 : next;
+	}
+}
+#endif
+
+/* Private allocation flag: fail rather than coalesce the quick lists. */
+#define TLSF_NO_COALESCE (1U << 31)
+
+static block_header_t* block_locate_free(control_t* control, size_t size,
+	unsigned int flags)
+{
+	int fl = 0, sl = 0;
+	block_header_t* block = 0;
+
+#ifdef TLSF_REMOTE_FREE
+	if (atomic_load_explicit(&control->remote_free, memory_order_relaxed))
+	{
+		control_drain(control);
+	}
+#endif
+
+	if (size && (flags & TLSF_BEST_FIT))
+	{
+		block = search_exact_block(control, size, &fl, &sl);
+	}
+
+	if (size && !block)
+	{
+		mapping_search(size, &fl, &sl);
+
+		/* Rounding up may have pushed the request past the last list. */
+		if (fl < FL_INDEX_COUNT)
+		{
+			block = search_suitable_block(control, &fl, &sl);
+		}
+	}
+
+#if TLSF_QUICK_LISTS
+	/* Deferred frees are only coalesced once the free lists come up short. */
+	if (size && !block && control->quick_total && !(flags & TLSF_NO_COALESCE))
+	{
+		control_flush_all_quick(control);
+		return block_locate_free(control, size, flags);
+	}
+#endif
 
 	if (block)
 	{
+		/*
+		** Unlinking the block writes its successor in the list, trimming
+		** it writes the header of the remainder and relinks the next block.
+		** Start all three misses before taking the first one.
+		*/
+		tlsf_prefetch(block_next_free_link(block));
+		tlsf_prefetch(offset_to_block(block, size + block_header_overhead));
+		tlsf_prefetch(block_next(block));
+
 		tlsf_assert(block_size(block) >= size);
-		remove_free_block(block, fl, sl);
+		remove_free_block(control, block, fl, sl);
 	}
 
 	return block;
 }
 
-static void* block_prepare_used(block_header_t* block, size_t size)
+/* Tag, account for and guard a used block that goes to the user. */
+static void* block_hand_out(control_t* control, block_header_t* block, unsigned int tag)
+{
+	block_set_tag(block, tag);
+	control_count_used(control, block);
+	control_touch(control, block);
+	block_set_canary(block);
+	return block_to_ptr(block);
+}
+
+static void* block_prepare_used(control_t* control, block_header_t* block, size_t size,
+	unsigned int tag)
 {
 	void* p = 0;
 	if (block)
 	{
-		block_trim_free(block, size);
+		block_trim_free(control, block, size);
 		block_mark_as_used(block);
-		p = block_to_ptr(block);
+		p = block_hand_out(control, block, tag);
 	}
 	return p;
 }
 
+/* Allocate size bytes, reusing a deferred free of that size if there is one. */
+static void* control_malloc(control_t* control, size_t size, unsigned int flags,
+	unsigned int tag)
+{
+	block_header_t* block = control_pop_quick(control, size);
+	if (block)
+	{
+		return block_hand_out(control, block, tag);
+	}
+	block = block_locate_free(control, size, flags);
+	return block_prepare_used(control, block, size, tag);
+}
+
 /* Clear structure and point all empty lists at the null block. */
-static void control_construct(void)
+static void control_construct(control_t* control)
 {
 	int i, j;
 
-	control->block_null.next_free = &control->block_null;
-	control->block_null.prev_free = &control->block_null;
+	block_set_next_free_link(&control->block_null, &control->block_null);
+	block_set_prev_free_link(&control->block_null, &control->block_null);
 
 	control->fl_bitmap = 0;
+	control->flags = 0;
+#ifdef TLSF_STATS
+	control->stats_total = 0;
+	control->stats_used = 0;
+	control->stats_peak = 0;
+	control->stats_count = 0;
+#endif
 	for (i = 0; i < FL_INDEX_COUNT; ++i)
 	{
 		control->sl_bitmap[i] = 0;
@@ -593,6 +1447,42 @@ static void control_construct(void)
 			control->blocks[i][j] = &control->block_null;
 		}
 	}
+
+#ifdef TLSF_REMOTE_FREE
+	atomic_init(&control->remote_free, 0);
+#endif
+
+#if TLSF_QUICK_LISTS
+	for (i = 0; i < TLSF_QUICK_LISTS; ++i)
+	{
+		control->quick[i] = 0;
+		control->quick_count[i] = 0;
+	}
+	control->quick_total = 0;
+#endif
+
+#if TLSF_ZEROED_POOLS
+	for (i = 0; i < TLSF_ZEROED_POOLS; ++i)
+	{
+		control->zeroed[i].start = 0;
+	}
+#endif
+
+#if TLSF_TAG_BITS
+	for (i = 0; i < TLSF_TAG_COUNT; ++i)
+	{
+		control->tag_used[i] = 0;
+		control->tag_budget[i] = 0;
+	}
+#endif
+
+#if defined (TLSF_RELEASE_HOOKS)
+	control->release_hook = 0;
+	control->acquire_hook = 0;
+	control->hook_user = 0;
+	control->hook_granule = 0;
+	control->hook_threshold = 0;
+#endif
 }
 
 #ifdef DEVELHELP
@@ -603,28 +1493,44 @@ typedef void (*tlsf_walker)(void* ptr, size_t size, int used);
 
 static void default_walker(void* ptr, size_t size, int used)
 {
+#if TLSF_TAG_BITS
+    if (used) {
+        printf("\tMemory @ %p is used, size: %u, tag: %u (block: %p)\n", ptr,
+               (unsigned int)size, block_tag(block_from_ptr(ptr)),
+               (void*) block_from_ptr(ptr));
+        return;
+    }
+#endif
     printf("\tMemory @ %p is %s, size: %u (block: %p)\n", ptr, used ? "used" : "free",
            (unsigned int)size, (void*) block_from_ptr(ptr));
 }
 
-void tlsf_walk_pool(void *pool)
+void tlsf_walk_pool_tagged(pool_t pool, int tag)
 {
     if (!pool) {
-        pool = default_pool;
+        pool = tlsf_get_pool(default_control);
     }
 	block_header_t* block =
-		offset_to_block(pool, -(int)block_header_overhead);
+		offset_to_block(pool, -(tlsfptr_t)offsetof(block_header_t, size));
 
 	while (block && !block_is_last(block))
 	{
-		default_walker(
-			block_to_ptr(block),
-			block_size(block),
-			!block_is_free(block));
+		const int used = !block_is_free(block);
+		if (tag < 0 || (used && block_tag(block) == tlsf_cast(unsigned int, tag)))
+		{
+			default_walker(block_to_ptr(block), block_size(block), used);
+		}
 		block = block_next(block);
 	}
 }
 
+void tlsf_walk_pool(pool_t pool)
+{
+	tlsf_walk_pool_tagged(pool, -1);
+}
+
+#endif
+
 size_t tlsf_block_size(void* ptr)
 {
 	size_t size = 0;
@@ -635,9 +1541,134 @@ size_t tlsf_block_size(void* ptr)
 	}
 	return size;
 }
+
+size_t tlsf_usable_size(const void* ptr)
+{
+	return ptr ? block_size(block_from_ptr(ptr)) - TLSF_CANARY_SIZE : 0;
+}
+
+/*
+** Integrity checks, also available in release builds. Every problem found
+** is passed to tlsf_assert and counted; the result is 0 for a sound heap
+** and minus the number of problems otherwise.
+*/
+#define tlsf_insist(x) { tlsf_assert(x); if (!(x)) { status--; } }
+
+int tlsf_check_ex(tlsf_t tlsf)
+{
+	const control_t* control = tlsf_cast(const control_t*, tlsf);
+	int status = 0;
+	int i, j;
+
+	/* Check that the free lists and bitmaps are accurate. */
+	for (i = 0; i < FL_INDEX_COUNT; ++i)
+	{
+		for (j = 0; j < SL_INDEX_COUNT; ++j)
+		{
+			const unsigned int fl_map = control->fl_bitmap & (1U << i);
+			const tlsfslmap_t sl_list = control->sl_bitmap[i];
+			const tlsfslmap_t sl_map = sl_list & (tlsf_cast(tlsfslmap_t, 1) << j);
+			const block_header_t* block = control->blocks[i][j];
+
+			/* Check that first- and second-level lists agree. */
+			if (!fl_map)
+			{
+				tlsf_insist(!sl_map && "second-level map must be null");
+			}
+
+			if (!sl_map)
+			{
+				tlsf_insist(block == &control->block_null && "block list must be null");
+				continue;
+			}
+
+			/* Check that there is at least one free block. */
+			tlsf_insist(sl_list && "no free blocks in second-level map");
+			tlsf_insist(block != &control->block_null && "block should not be null");
+
+			while (block != &control->block_null)
+			{
+				int fli, sli;
+				tlsf_insist(block_is_free(block) && "block should be free");
+				tlsf_insist(!block_is_prev_free(block) && "blocks should have coalesced");
+				tlsf_insist(!block_is_free(block_next(block)) && "blocks should have coalesced");
+				tlsf_insist(block_is_prev_free(block_next(block)) && "block should be free");
+				tlsf_insist(block_size(block) >= block_size_min && "block not minimum size");
+
+				mapping_insert(block_size(block), &fli, &sli);
+				tlsf_insist(fli == i && sli == j && "block size indexed in wrong list");
+				tlsf_insist((block_next_free_link(block) == &control->block_null
+					|| block_prev_free_link(block_next_free_link(block)) == block)
+					&& "free list links broken");
+				block = block_next_free_link(block);
+			}
+		}
+	}
+
+#if TLSF_QUICK_LISTS
+	/* Check the deferred frees. */
+	{
+		unsigned int total = 0;
+		for (i = 0; i < TLSF_QUICK_LISTS; ++i)
+		{
+			const block_header_t* block = control->quick[i];
+			for (j = 0; j < control->quick_count[i]; ++j)
+			{
+				tlsf_insist(!block_is_free(block) && "deferred block marked as free");
+				tlsf_insist(quick_index(block_size(block)) == i && "deferred block on wrong list");
+				block = block_next_free_link(block);
+			}
+			total += control->quick_count[i];
+		}
+		tlsf_insist(total == control->quick_total && "deferred block count wrong");
+	}
 #endif
 
-int tlsf_add_pool(void* mem, size_t bytes)
+	return status;
+}
+
+/* Check the physical chain of blocks of a pool. */
+int tlsf_check_pool(pool_t pool)
+{
+	const block_header_t* block =
+		offset_to_block(pool, -(tlsfptr_t)offsetof(block_header_t, size));
+	int prev_free = 0;
+	int status = 0;
+
+	while (!block_is_last(block))
+	{
+		const block_header_t* next = block_next(block);
+		const int is_free = block_is_free(block);
+
+		tlsf_insist(!block_is_prev_free(block) == !prev_free && "prev status incorrect");
+		tlsf_insist(block_size(block) % ALIGN_SIZE == 0 && "block size misaligned");
+		tlsf_insist(block_size(block) >= block_size_min && "block not minimum size");
+		if (is_free)
+		{
+			tlsf_insist(!prev_free && "blocks should have coalesced");
+			tlsf_insist(block_prev(next) == block && "prev_phys_block link broken");
+		}
+		else
+		{
+			tlsf_insist(block_canary_ok(block) && "guard word overwritten");
+		}
+
+		prev_free = is_free;
+		block = next;
+	}
+	tlsf_insist(!block_is_prev_free(block) == !prev_free && "prev status incorrect");
+
+	return status;
+}
+
+#undef tlsf_insist
+
+pool_t tlsf_get_pool(tlsf_t tlsf)
+{
+	return tlsf_cast(pool_t, (char*)tlsf + tlsf_size());
+}
+
+pool_t tlsf_add_pool_ex(tlsf_t tlsf, void* mem, size_t bytes)
 {
 	block_header_t* block;
 	block_header_t* next;
@@ -647,16 +1678,22 @@ int tlsf_add_pool(void* mem, size_t bytes)
 
 	if (((ptrdiff_t)mem % ALIGN_SIZE) != 0)
 	{
-		printf("tlsf_add_pool: Memory must be aligned by %u bytes.\n",
+		tlsf_error("tlsf_add_pool: Memory must be aligned by %u bytes.\n",
 			(unsigned int)ALIGN_SIZE);
 		return 0;
 	}
 
-	if (pool_bytes < block_size_min || pool_bytes > block_size_max)
+	if (!control_links_reach(tlsf, mem, bytes))
+	{
+		tlsf_error("tlsf_add_pool: Memory must lie within 1 GB of the TLSF structure.\n");
+		return 0;
+	}
+
+	if (pool_bytes < block_size_min || pool_bytes >= block_size_max)
 	{
-		printf("tlsf_add_pool: Memory size must be between %u and %u bytes.\n",
+		tlsf_error("tlsf_add_pool: Memory size must be between %u and %u bytes.\n",
 			(unsigned int)(pool_overhead + block_size_min),
-			(unsigned int)(pool_overhead + block_size_max));
+			(unsigned int)(pool_overhead + block_size_max - ALIGN_SIZE));
 		return 0;
 	}
 
@@ -665,121 +1702,725 @@ int tlsf_add_pool(void* mem, size_t bytes)
 	** so that the prev_phys_block field falls outside of the pool -
 	** it will never be used.
 	*/
-	block = offset_to_block(mem, -(tlsfptr_t)block_header_overhead);
+	block = offset_to_block(mem, -(tlsfptr_t)offsetof(block_header_t, size));
 	block_set_size(block, pool_bytes);
 	block_set_free(block);
 	block_set_prev_used(block);
-	block_insert(block);
+	block_insert(tlsf_cast(control_t*, tlsf), block);
 
 	/* Split the block to create a zero-size sentinel block. */
 	next = block_link_next(block);
 	block_set_size(next, 0);
 	block_set_used(next);
 	block_set_prev_free(next);
+	control_release(tlsf_cast(control_t*, tlsf), block, block, next);
 
-    default_pool = mem;
+#ifdef TLSF_STATS
+	tlsf_cast(control_t*, tlsf)->stats_total += pool_bytes + block_header_overhead;
+#endif
 
-	return 1;
+	return mem;
 }
 
 /*
-** TLSF main interface.
+** A pool can only be removed in O(1) if it is empty, in which case it
+** consists of a single free block followed by the sentinel block.
 */
-
-void tlsf_create(void* mem)
+int tlsf_remove_pool_ex(tlsf_t tlsf, pool_t pool)
 {
-	if (((tlsfptr_t)mem % ALIGN_SIZE) != 0)
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	block_header_t* block =
+		offset_to_block(pool, -(tlsfptr_t)offsetof(block_header_t, size));
+
+	/* Deferred frees would keep the pool from looking empty. */
+#ifdef TLSF_REMOTE_FREE
+	control_drain(control);
+#endif
+	control_flush_all_quick(control);
+
+	if (!block_is_free(block) || !block_is_last(block_next(block)))
 	{
-		printf("tlsf_create: Memory must be aligned to %u bytes.\n",
-			(unsigned int)ALIGN_SIZE);
-		return;
+		return 0;
 	}
 
-    control = tlsf_cast(control_t*, mem);
+	block_remove(control, block);
+	control_acquire(control, block, block, block_next(block));
+#ifdef TLSF_STATS
+	control->stats_total -= block_size(block) + block_header_overhead;
+#endif
+#if TLSF_ZEROED_POOLS
+	{
+		zeroed_pool_t* zeroed = control_zeroed_pool(control, pool);
+		if (zeroed)
+		{
+			zeroed->start = 0;
+		}
+	}
+#endif
+	return 1;
+}
 
-	control_construct();
+/*
+** Add a pool whose memory is known to be zero, e.g. in .bss. Allocations
+** from its untouched part are not cleared again by tlsf_calloc. If all
+** TLSF_ZEROED_POOLS entries are in use, the pool is added as a plain one.
+*/
+pool_t tlsf_add_zeroed_pool_ex(tlsf_t tlsf, void* mem, size_t bytes)
+{
+	pool_t pool = tlsf_add_pool_ex(tlsf, mem, bytes);
+#if TLSF_ZEROED_POOLS
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	int i;
+	for (i = 0; pool && i < TLSF_ZEROED_POOLS; ++i)
+	{
+		zeroed_pool_t* zeroed = &control->zeroed[i];
+		if (!zeroed->start)
+		{
+			zeroed->start = tlsf_cast(char*, mem);
+			zeroed->end = tlsf_cast(char*, mem) + bytes;
+			zeroed->clean = zeroed->start;
+			break;
+		}
+	}
+#endif
+	return pool;
 }
 
-void tlsf_create_with_pool(void* mem, size_t bytes)
+pool_t tlsf_add_pool(void* mem, size_t bytes)
 {
-	tlsf_create(mem);
-	tlsf_add_pool((char*)mem + sizeof(control_t), bytes - sizeof(control_t));
+	return tlsf_add_pool_ex(default_control, mem, bytes);
 }
 
-void* tlsf_malloc(size_t size)
+int tlsf_remove_pool(pool_t pool)
 {
-	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
-	block_header_t* block = block_locate_free(adjust);
-	return block_prepare_used(block, adjust);
+	return tlsf_remove_pool_ex(default_control, pool);
 }
 
-void* tlsf_memalign(size_t align, size_t size)
+pool_t tlsf_add_zeroed_pool(void* mem, size_t bytes)
 {
-	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	return tlsf_add_zeroed_pool_ex(default_control, mem, bytes);
+}
 
-	/*
-	** We must allocate an additional minimum block size bytes so that if
-	** our free block will leave an alignment gap which is smaller, we can
-	** trim a leading free block and release it back to the pool. We must
-	** do this because the previous physical block is in use, therefore
-	** the prev_phys_block field is not valid, and we can't simply adjust
-	** the size of that block.
-	*/
-	const size_t gap_minimum = sizeof(block_header_t);
-	const size_t size_with_gap = adjust_request_size(adjust + align + gap_minimum, align);
+/*
+** TLSF main interface.
+*/
 
-	/* If alignment is less than or equals base alignment, we're done. */
-	const size_t aligned_size = (align <= ALIGN_SIZE) ? adjust : size_with_gap;
+tlsf_t tlsf_create(void* mem)
+{
+	const size_t align = tlsf_max(ALIGN_SIZE, TLSF_CACHE_LINE_SIZE);
 
-	block_header_t* block = block_locate_free(aligned_size);
+	if (((tlsfptr_t)mem % align) != 0)
+	{
+		tlsf_error("tlsf_create: Memory must be aligned to %u bytes.\n",
+			(unsigned int)align);
+		return 0;
+	}
 
-	/* This can't be a static assert. */
-	tlsf_assert(sizeof(block_header_t) == block_size_min + block_header_overhead);
+	control_construct(tlsf_cast(control_t*, mem));
 
-	if (block)
+	/* The first instance created serves the handle-less interface. */
+	if (!default_control)
 	{
-		void* ptr = block_to_ptr(block);
-		void* aligned = align_ptr(ptr, align);
-		size_t gap = tlsf_cast(size_t,
-			tlsf_cast(tlsfptr_t, aligned) - tlsf_cast(tlsfptr_t, ptr));
-
-		/* If gap size is too small, offset to next aligned boundary. */
-		if (gap && gap < gap_minimum)
-		{
-			const size_t gap_remain = gap_minimum - gap;
-			const size_t offset = tlsf_max(gap_remain, align);
-			const void* next_aligned = tlsf_cast(void*,
-				tlsf_cast(tlsfptr_t, aligned) + offset);
+		default_control = tlsf_cast(control_t*, mem);
+	}
 
-			aligned = align_ptr(next_aligned, align);
-			gap = tlsf_cast(size_t,
-				tlsf_cast(tlsfptr_t, aligned) - tlsf_cast(tlsfptr_t, ptr));
-		}
+	return tlsf_cast(tlsf_t, mem);
+}
+
+tlsf_t tlsf_create_with_pool(void* mem, size_t bytes)
+{
+	tlsf_t tlsf = tlsf_create(mem);
+	if (tlsf && bytes < tlsf_size())
+	{
+		tlsf_error("tlsf_create_with_pool: Memory must be at least %u bytes.\n",
+			(unsigned int)tlsf_size());
+	}
+	if (tlsf && (bytes < tlsf_size()
+		|| !tlsf_add_pool_ex(tlsf, tlsf_get_pool(tlsf), bytes - tlsf_size())))
+	{
+		tlsf_destroy(tlsf);
+		tlsf = 0;
+	}
+	return tlsf;
+}
+
+void tlsf_destroy(tlsf_t tlsf)
+{
+	/* The memory belongs to the caller, only forget it as the default. */
+	if (tlsf_cast(control_t*, tlsf) == default_control)
+	{
+		default_control = 0;
+	}
+}
+
+void tlsf_set_error_handler(tlsf_error_handler handler)
+{
+	error_handler = handler;
+}
+
+tlsf_t tlsf_get_default(void)
+{
+	return tlsf_cast(tlsf_t, default_control);
+}
+
+void tlsf_set_default(tlsf_t tlsf)
+{
+	default_control = tlsf_cast(control_t*, tlsf);
+}
+
+size_t tlsf_size(void)
+{
+	/* Keep a pool placed directly after the control structure aligned. */
+	return align_up(sizeof(control_t), ALIGN_SIZE);
+}
+
+size_t tlsf_align_size(void)
+{
+	return ALIGN_SIZE;
+}
+
+size_t tlsf_block_size_min(void)
+{
+	return block_size_min;
+}
+
+size_t tlsf_block_size_max(void)
+{
+	return block_size_max;
+}
+
+/*
+** Overhead of the TLSF structures in a given memory block passed to
+** tlsf_add_pool, equal to the overhead of a free block and the
+** sentinel block.
+*/
+size_t tlsf_pool_overhead(void)
+{
+	return 2 * block_header_overhead;
+}
+
+size_t tlsf_alloc_overhead(void)
+{
+	return block_header_overhead;
+}
+
+/*
+** Size classes are the free lists flattened to fl * SL_INDEX_COUNT + sl.
+** Every block filed under a class can satisfy any request mapped to it.
+*/
+int tlsf_size_class(size_t size)
+{
+	int fl, sl;
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	if (!adjust)
+	{
+		return -1;
+	}
+	mapping_search(adjust, &fl, &sl);
+	return fl < FL_INDEX_COUNT ? fl * SL_INDEX_COUNT + sl : -1;
+}
+
+int tlsf_block_class(void* ptr)
+{
+	int fl, sl;
+	mapping_insert(block_size(block_from_ptr(ptr)), &fl, &sl);
+	return fl * SL_INDEX_COUNT + sl;
+}
+
+size_t tlsf_class_size(int sclass)
+{
+	return mapping_size(sclass / SL_INDEX_COUNT, sclass % SL_INDEX_COUNT);
+}
+
+size_t tlsf_bucket_count(void)
+{
+	return FL_INDEX_COUNT * SL_INDEX_COUNT;
+}
+
+/*
+** Walk the non-empty free lists, as found in the bitmaps. This costs
+** O(number of free blocks) and is meant for diagnostics only.
+*/
+void tlsf_fragmentation_report_ex(tlsf_t tlsf, tlsf_bucket_t* buckets,
+	size_t count, tlsf_fragmentation_t* report)
+{
+	const control_t* control = tlsf_cast(const control_t*, tlsf);
+	unsigned int fl_map = control->fl_bitmap;
+	size_t i;
+
+	for (i = 0; buckets && i < count; ++i)
+	{
+		buckets[i].count = 0;
+		buckets[i].bytes = 0;
+	}
+	report->free_blocks = 0;
+	report->free_bytes = 0;
+	report->largest_free = 0;
+
+	while (fl_map)
+	{
+		const int fl = tlsf_ffs(fl_map);
+		tlsfslmap_t sl_map = control->sl_bitmap[fl];
+		fl_map &= ~(1U << fl);
+
+		while (sl_map)
+		{
+			const int sl = tlsf_sl_ffs(sl_map);
+			const size_t index = tlsf_cast(size_t, fl * SL_INDEX_COUNT + sl);
+			const block_header_t* block = control->blocks[fl][sl];
+			sl_map &= ~(tlsf_cast(tlsfslmap_t, 1) << sl);
+
+			for (; block != &control->block_null; block = block_next_free_link(block))
+			{
+				const size_t size = block_size(block);
+				if (buckets && index < count)
+				{
+					++buckets[index].count;
+					buckets[index].bytes += size;
+				}
+				++report->free_blocks;
+				report->free_bytes += size;
+				report->largest_free = tlsf_max(report->largest_free, size);
+			}
+		}
+	}
+
+	report->fragmentation = report->free_bytes ? tlsf_cast(unsigned int, 1000 -
+		(report->largest_free * 1000ULL) / report->free_bytes) : 0;
+}
+
+#ifdef TLSF_STATS
+/*
+** All counters are maintained on the fly. The largest free block is
+** approximated by the smallest size of the largest non-empty free list,
+** which is the largest request that is guaranteed to succeed.
+*/
+void tlsf_get_stats_ex(tlsf_t tlsf, tlsf_stats_t* stats)
+{
+	const control_t* control = tlsf_cast(const control_t*, tlsf);
+	const int fl = tlsf_fls(control->fl_bitmap);
+
+	stats->total = control->stats_total;
+	stats->used = control->stats_used;
+	stats->free = control->stats_total - control->stats_used;
+	stats->peak = control->stats_peak;
+	stats->count = control->stats_count;
+	stats->largest_free = (fl < 0) ? 0 :
+		mapping_size(fl, tlsf_sl_fls(control->sl_bitmap[fl]));
+}
+#endif
+
+void* tlsf_malloc_ex(tlsf_t tlsf, size_t size)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	return control_malloc(control, adjust, control->flags, 0);
+}
+
+/*
+** Tagged blocks are counted per tag, and a tag with a budget fails as soon
+** as the request would take it over the budget, without searching.
+*/
+void* tlsf_malloc_tagged_ex(tlsf_t tlsf, unsigned int tag, size_t size)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+#if TLSF_TAG_BITS
+	block_header_t* block;
+
+	tlsf_assert(tag < TLSF_TAG_COUNT && "tag out of range");
+	if (tag >= TLSF_TAG_COUNT
+		|| !control_in_budget(control, tag, adjust + block_header_overhead))
+	{
+		return 0;
+	}
+
+	/* A quick list block has exactly the size checked above. */
+	block = control_pop_quick(control, adjust);
+	if (block)
+	{
+		return block_hand_out(control, block, tag);
+	}
+
+	/*
+	** A block too small to split is charged, and later freed, whole.
+	** Check that before handing it out, so a refusal leaves no trace.
+	*/
+	block = block_locate_free(control, adjust, control->flags);
+	if (block && !block_can_split(block, adjust)
+		&& !control_in_budget(control, tag, block_size(block) + block_header_overhead))
+	{
+		block_insert(control, block);
+		return 0;
+	}
+	return block_prepare_used(control, block, adjust, tag);
+#else
+	(void) tag;
+	return control_malloc(control, adjust, control->flags, 0);
+#endif
+}
+
+void tlsf_set_tag_budget_ex(tlsf_t tlsf, unsigned int tag, size_t bytes)
+{
+#if TLSF_TAG_BITS
+	tlsf_assert(tag && tag < TLSF_TAG_COUNT && "tag out of range");
+	if (tag && tag < TLSF_TAG_COUNT)
+	{
+		tlsf_cast(control_t*, tlsf)->tag_budget[tag] = bytes;
+	}
+#else
+	(void) tlsf;
+	(void) tag;
+	(void) bytes;
+#endif
+}
+
+size_t tlsf_tag_used_ex(tlsf_t tlsf, unsigned int tag)
+{
+#if TLSF_TAG_BITS
+	return tag < TLSF_TAG_COUNT ? tlsf_cast(const control_t*, tlsf)->tag_used[tag] : 0;
+#else
+	(void) tlsf;
+	(void) tag;
+	return 0;
+#endif
+}
+
+unsigned int tlsf_tag_count(void)
+{
+	return TLSF_TAG_COUNT;
+}
+
+unsigned int tlsf_block_tag(const void* ptr)
+{
+	return ptr ? block_tag(block_from_ptr(ptr)) : 0;
+}
+
+void* tlsf_malloc_clean_ex(tlsf_t tlsf, size_t size, size_t* dirty)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	block_header_t* block = block_locate_free(control, adjust, control->flags);
+
+	void* p;
+
+	/* Evaluate before the allocation moves the clean boundary. */
+	*dirty = block ? control_dirty_size(control, block_to_ptr(block), size) : 0;
+	p = block_prepare_used(control, block, adjust, 0);
+
+	/* Trimming links the remainder back through the last word of the block. */
+	if (p && *dirty < size && adjust - sizeof(tlsflink_t) < size)
+	{
+		memset(tlsf_cast(char*, p) + adjust - sizeof(tlsflink_t), 0,
+			sizeof(tlsflink_t));
+	}
+	return p;
+}
+
+void* tlsf_malloc_at_least_ex(tlsf_t tlsf, size_t size, size_t* actual)
+{
+	void* p = tlsf_malloc_ex(tlsf, size);
+	*actual = tlsf_usable_size(p);
+	return p;
+}
+
+void* tlsf_calloc_ex(tlsf_t tlsf, size_t count, size_t size)
+{
+	size_t dirty;
+	void* p;
+
+	if (size && count > tlsf_cast(size_t, -1) / size)
+	{
+		return 0;
+	}
+
+	p = tlsf_malloc_clean_ex(tlsf, count * size, &dirty);
+	if (p)
+	{
+		memset(p, 0, dirty);
+	}
+	return p;
+}
+
+void* tlsf_malloc_flags_ex(tlsf_t tlsf, size_t size, unsigned int flags)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	return control_malloc(control, adjust, flags, 0);
+}
+
+void tlsf_set_flags_ex(tlsf_t tlsf, unsigned int flags)
+{
+	tlsf_cast(control_t*, tlsf)->flags = flags;
+}
+
+unsigned int tlsf_get_flags_ex(tlsf_t tlsf)
+{
+	return tlsf_cast(const control_t*, tlsf)->flags;
+}
+
+void* tlsf_memalign_ex(tlsf_t tlsf, size_t align, size_t size)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+
+	/*
+	** We must allocate an additional minimum block size bytes so that if
+	** our free block will leave an alignment gap which is smaller, we can
+	** trim a leading free block and release it back to the pool. We must
+	** do this because the previous physical block is in use, therefore
+	** the prev_phys_block field is not valid, and we can't simply adjust
+	** the size of that block.
+	*/
+	const size_t gap_minimum = block_header_overhead + block_size_min;
+	const size_t size_with_gap = adjust_request_size(adjust + align + gap_minimum, align);
+
+	/*
+	** If alignment is less than or equals base alignment, we're done. Sizes
+	** that adjust to 0 fail like in malloc instead of taking a gap block.
+	*/
+	const size_t aligned_size = (!adjust || align <= ALIGN_SIZE) ? adjust : size_with_gap;
+
+	block_header_t* block = block_locate_free(control, aligned_size, control->flags);
+
+	if (block)
+	{
+		void* ptr = block_to_ptr(block);
+		void* aligned = align_ptr(ptr, align);
+		size_t gap = tlsf_cast(size_t,
+			tlsf_cast(tlsfptr_t, aligned) - tlsf_cast(tlsfptr_t, ptr));
+
+		/* If gap size is too small, offset to next aligned boundary. */
+		if (gap && gap < gap_minimum)
+		{
+			const size_t gap_remain = gap_minimum - gap;
+			const size_t offset = tlsf_max(gap_remain, align);
+			const void* next_aligned = tlsf_cast(void*,
+				tlsf_cast(tlsfptr_t, aligned) + offset);
+
+			aligned = align_ptr(next_aligned, align);
+			gap = tlsf_cast(size_t,
+				tlsf_cast(tlsfptr_t, aligned) - tlsf_cast(tlsfptr_t, ptr));
+		}
 
 		if (gap)
 		{
 			tlsf_assert(gap >= gap_minimum && "gap size too small");
-			block = block_trim_free_leading(block, gap);
+			block = block_trim_free_leading(control, block, gap);
 		}
 	}
 
-	return block_prepare_used(block, adjust);
+	return block_prepare_used(control, block, adjust, 0);
 }
 
-void tlsf_free(void* ptr)
+/*
+** Allocate up to count blocks of the same size, carving as many of them
+** as possible out of a single free block with consecutive splits. Returns
+** the number of blocks stored in ptrs, which is short only on exhaustion.
+*/
+size_t tlsf_malloc_batch_ex(tlsf_t tlsf, size_t size, size_t count, void** ptrs)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	const size_t stride = adjust + block_header_overhead;
+	size_t done = 0;
+
+	while (adjust && done < count)
+	{
+		size_t n = count - done;
+		block_header_t* block = 0;
+
+		/* Ask for a block that holds the whole run, else for a single one. */
+		if (n > 1 && n < block_size_max / stride)
+		{
+			block = block_locate_free(control, n * stride - block_header_overhead,
+				control->flags | TLSF_NO_COALESCE);
+		}
+		if (!block)
+		{
+			block = block_locate_free(control, adjust, control->flags);
+		}
+		if (!block)
+		{
+			break;
+		}
+
+		n = tlsf_min(n, (block_size(block) + block_header_overhead) / stride);
+		control_acquire(control, block, block, offset_to_block(block, (n - 1) * stride));
+		while (--n)
+		{
+			block_header_t* remaining = block_split(block, adjust);
+			block_mark_as_used(block);
+			ptrs[done++] = block_hand_out(control, block, 0);
+			block = remaining;
+		}
+		ptrs[done++] = block_prepare_used(control, block, adjust, 0);
+	}
+
+	return done;
+}
+
+/*
+** Free a number of blocks at once. The array is sorted by address, so
+** that blocks of the batch which are physical neighbours are merged with
+** each other directly instead of going through the free lists. The sort
+** is quadratic in count, which is meant to be small.
+*/
+void tlsf_free_batch_ex(tlsf_t tlsf, void** ptrs, size_t count)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	size_t i, j;
+
+	for (i = 1; i < count; ++i)
+	{
+		void* ptr = ptrs[i];
+		for (j = i; j > 0 && tlsf_cast(tlsfptr_t, ptrs[j - 1]) > tlsf_cast(tlsfptr_t, ptr); --j)
+		{
+			ptrs[j] = ptrs[j - 1];
+		}
+		ptrs[j] = ptr;
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		block_header_t* block;
+		block_header_t* used;
+		block_header_t* next;
+
+		/* NULL pointers have been sorted to the front. */
+		if (!ptrs[i] || !block_check_canary(block_from_ptr(ptrs[i])))
+		{
+			continue;
+		}
+
+		block = block_from_ptr(ptrs[i]);
+		used = block;
+		tlsf_assert(!block_is_free(block) && "block already marked as free");
+		control_count_free(control, block);
+		block_mark_as_free(block);
+		block = block_merge_prev(control, block);
+
+		while (i + 1 < count && block_from_ptr(ptrs[i + 1]) == block_next(block)
+			&& block_canary_ok(block_from_ptr(ptrs[i + 1])))
+		{
+			block_header_t* next = block_from_ptr(ptrs[++i]);
+			tlsf_assert(!block_is_free(next) && "block already marked as free");
+			control_count_free(control, next);
+			block_mark_as_free(next);
+			block = block_absorb(block, next);
+		}
+
+		next = block_next(block);
+		block = block_merge_next(control, block);
+		block_insert(control, block);
+		control_release(control, block, used, next);
+	}
+}
+
+void tlsf_free_ex(tlsf_t tlsf, void* ptr)
 {
 	/* Don't attempt to free a NULL pointer. */
 	if (ptr)
 	{
+		control_t* control = tlsf_cast(control_t*, tlsf);
 		block_header_t* block = block_from_ptr(ptr);
-		tlsf_assert(!block_is_free(block) && "block already marked as free");
-		block_mark_as_free(block);
-		block = block_merge_prev(block);
-		block = block_merge_next(block);
-		block_insert(block);
+		if (!block_free_quick(control, block))
+		{
+			block_free(control, block);
+		}
 	}
 }
 
+/*
+** The size is checked against the header word that the free loads anyway,
+** which catches frees of the wrong pointer and of blocks shrunk in place.
+*/
+void tlsf_free_sized_ex(tlsf_t tlsf, void* ptr, size_t size)
+{
+	if (ptr)
+	{
+		control_t* control = tlsf_cast(control_t*, tlsf);
+		block_header_t* block = block_from_ptr(ptr);
+		if (size > block_size(block) - TLSF_CANARY_SIZE)
+		{
+			tlsf_error("tlsf_free_sized: block at %p is smaller than %lu bytes, not freed.\n",
+				ptr, tlsf_cast(unsigned long, size));
+			tlsf_assert(0 && "size larger than the block");
+			return;
+		}
+		if (!block_free_quick(control, block))
+		{
+			block_free(control, block);
+		}
+	}
+}
+
+void tlsf_coalesce_ex(tlsf_t tlsf)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+#ifdef TLSF_REMOTE_FREE
+	control_drain(control);
+#endif
+	control_flush_all_quick(control);
+}
+
+#if defined (TLSF_RELEASE_HOOKS)
+/*
+** Everything released with the old settings is acquired with the old
+** acquire hook before the free blocks are released with the new ones.
+*/
+void tlsf_set_release_hooks_ex(tlsf_t tlsf, tlsf_release_hook release,
+	tlsf_release_hook acquire, size_t granule, size_t threshold, void* user)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+
+	tlsf_assert(!(granule & (granule - 1)) && "granule must be a power of two");
+
+	control_notify_all(control, control->acquire_hook);
+	control->release_hook = release;
+	control->acquire_hook = acquire;
+	control->hook_user = user;
+	control->hook_granule = granule;
+	control->hook_threshold = threshold;
+	control_notify_all(control, control->release_hook);
+}
+#endif
+
+#ifdef TLSF_REMOTE_FREE
+/*
+** Queue a block for freeing without touching the free lists. This is
+** lock-free and may race with any other call on the same instance; the
+** block is coalesced by the next allocation or tlsf_drain_ex.
+*/
+void tlsf_free_remote_ex(tlsf_t tlsf, void* ptr)
+{
+	if (ptr)
+	{
+		control_t* control = tlsf_cast(control_t*, tlsf);
+		block_header_t* block = block_from_ptr(ptr);
+		block_header_t* head = atomic_load_explicit(&control->remote_free,
+			memory_order_relaxed);
+
+		/*
+		** Don't look at the size field here: neighbours update its
+		** prev_free bit under the caller's lock. block_free checks it.
+		** The end of the queue is a self link, which compact headers
+		** can express unlike a NULL pointer.
+		*/
+		do
+		{
+			block_set_next_free_link(block, head ? head : block);
+		} while (!atomic_compare_exchange_weak_explicit(&control->remote_free,
+			&head, block, memory_order_release, memory_order_relaxed));
+	}
+}
+
+void tlsf_drain_ex(tlsf_t tlsf)
+{
+	control_drain(tlsf_cast(control_t*, tlsf));
+}
+#endif
+
 /*
 ** The TLSF block information provides us with enough information to
 ** provide a reasonably intelligent implementation of realloc, growing or
@@ -793,59 +2434,319 @@ void tlsf_free(void* ptr)
 ** - an extended buffer size will leave the newly-allocated area with
 **   contents undefined
 */
-void* tlsf_realloc(void* ptr, size_t size)
+void* tlsf_realloc_ex(tlsf_t tlsf, void* ptr, size_t size)
 {
 	void* p = 0;
 
 	/* Zero-size requests are treated as free. */
 	if (ptr && size == 0)
 	{
-		tlsf_free(ptr);
+		tlsf_free_ex(tlsf, ptr);
 	}
 	/* Requests with NULL pointers are treated as malloc. */
 	else if (!ptr)
 	{
-		p = tlsf_malloc(size);
+		p = tlsf_malloc_ex(tlsf, size);
 	}
-	else
+	/* Try to resize in place, otherwise we must reallocate and copy. */
+	else if (!(p = tlsf_resize_move_ex(tlsf, ptr, size)))
 	{
-		block_header_t* block = block_from_ptr(ptr);
-		block_header_t* next = block_next(block);
+		p = tlsf_malloc_tagged_ex(tlsf, tlsf_block_tag(ptr), size);
+		if (p)
+		{
+			const size_t minsize = tlsf_min(tlsf_usable_size(ptr), size);
+			memcpy(p, ptr, minsize);
+			tlsf_free_ex(tlsf, ptr);
+		}
+	}
 
-		const size_t cursize = block_size(block);
-		const size_t combined = cursize + block_size(next) + block_header_overhead;
-		const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	return p;
+}
 
-		tlsf_assert(!block_is_free(block) && "block already marked as free");
+/*
+** Resize a block without moving it, growing into the next physical block
+** if that one is free. A request that cannot be satisfied this way returns
+** NULL and leaves the block untouched.
+*/
+void* tlsf_resize_ex(tlsf_t tlsf, void* ptr, size_t size)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	block_header_t* block = block_from_ptr(ptr);
+	block_header_t* next = block_next(block);
 
-		/*
-		** If the next block is used, or when combined with the current
-		** block, does not offer enough space, we must reallocate and copy.
-		*/
-		if (adjust > cursize && (!block_is_free(next) || adjust > combined))
-		{
-			p = tlsf_malloc(size);
-			if (p)
-			{
-				const size_t minsize = tlsf_min(cursize, size);
-				memcpy(p, ptr, minsize);
-				tlsf_free(ptr);
-			}
-		}
-		else
-		{
-			/* Do we need to expand to the next block? */
-			if (adjust > cursize)
-			{
-				block_merge_next(block);
-				block_mark_as_used(block);
-			}
+	const size_t cursize = block_size(block);
+	const size_t combined = cursize + block_size(next) + block_header_overhead;
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	const int split = combined >= adjust + block_header_overhead + block_size_min;
 
-			/* Trim the resulting block and return the original pointer. */
-			block_trim_used(block, adjust);
-			p = ptr;
-		}
+	tlsf_assert(!block_is_free(block) && "block already marked as free");
+
+	/*
+	** Fail if the size is out of range, or if the next block is used or,
+	** when combined with the current block, does not offer enough space,
+	** or if growing would take the tag of the block over its budget; a
+	** next block too small to split is taken whole.
+	*/
+	if (!adjust || (adjust > cursize && (!block_is_free(next) || adjust > combined
+		|| !control_in_budget(control, block_tag(block),
+			(split ? adjust : combined) - cursize))))
+	{
+		return 0;
 	}
 
+	control_count_free(control, block);
+
+	/* Do we need to expand to the next block? What is trimmed stays free. */
+	if (adjust > cursize)
+	{
+		control_acquire(control, next, next, split
+			? offset_to_block(block, adjust + block_header_overhead) : block_next(next));
+		block_merge_next(control, block);
+		block_mark_as_used(block);
+	}
+
+	/* Trim the resulting block and return the original pointer. */
+	block_trim_used(control, block, adjust, adjust > cursize);
+	control_count_used(control, block);
+	control_touch(control, block);
+	block_set_canary(block);
+	return ptr;
+}
+
+/* Grow, but never shrink or move, a block to hold at least size bytes. */
+int tlsf_try_expand_ex(tlsf_t tlsf, void* ptr, size_t size)
+{
+	return size <= tlsf_usable_size(ptr) || tlsf_resize_ex(tlsf, ptr, size);
+}
+
+/*
+** Move a used block down to the start of its free previous block, which
+** it absorbs together with the next block if that is free and needed for
+** adjust bytes. Returns the new location, or NULL if the space is short
+** or the tag of the block would go over its budget.
+*/
+static void* block_move_down(control_t* control, block_header_t* block, size_t adjust)
+{
+	block_header_t* prev = block_prev(block);
+	block_header_t* next = block_next(block);
+	void* ptr = block_to_ptr(block);
+	void* p;
+
+	const size_t cursize = block_size(block);
+	const unsigned int tag = block_tag(block);
+	size_t combined;
+	size_t grown;
+
+	tlsf_assert(block_is_free(prev) && "prev block is not free though marked as such");
+	combined = block_size(prev) + block_header_overhead + cursize;
+
+	/* Only take the next block if the previous one is not enough. */
+	if (adjust > combined && block_is_free(next))
+	{
+		combined += block_size(next) + block_header_overhead;
+	}
+	else
+	{
+		next = 0;
+	}
+	if (adjust > combined)
+	{
+		return 0;
+	}
+
+	/* Charge the tag for the final size, the trim may not split. */
+	grown = (combined >= adjust + block_header_overhead + block_size_min) ? adjust : combined;
+	if (grown > cursize && !control_in_budget(control, tag, grown - cursize))
+	{
+		return 0;
+	}
+
+	/* All of the free space is acquired, the trim releases what is left. */
+	control_count_free(control, block);
+	block_remove(control, prev);
+	control_acquire(control, prev, prev, block);
+	if (next)
+	{
+		block_remove(control, next);
+		control_acquire(control, next, next, block_next(next));
+	}
+
+	/*
+	** The move overwrites the header of the current block, so all sizes
+	** were taken before and prev is only resized afterwards.
+	*/
+	p = block_to_ptr(prev);
+	memmove(p, ptr, cursize);
+	block_set_size(prev, combined);
+	block_mark_as_used(prev);
+	block_set_tag(prev, tag);
+
+	block_trim_used(control, prev, adjust, 0);
+	control_count_used(control, prev);
+	control_touch(control, prev);
+	block_set_canary(prev);
 	return p;
 }
+
+/*
+** Like tlsf_resize_ex, but if the block cannot grow in place and the
+** previous physical block is free, absorb that one (and the next block, if
+** it is free and still needed) and move the data down to its start.
+*/
+void* tlsf_resize_move_ex(tlsf_t tlsf, void* ptr, size_t size)
+{
+	control_t* control = tlsf_cast(control_t*, tlsf);
+	block_header_t* block = block_from_ptr(ptr);
+
+	const size_t adjust = adjust_request_size(size, ALIGN_SIZE);
+	void* p = tlsf_resize_ex(tlsf, ptr, size);
+
+	if (p || !adjust || !block_is_prev_free(block))
+	{
+		return p;
+	}
+	return block_move_down(control, block, adjust);
+}
+
+/*
+** Slide an allocation down into a free previous block, keeping its size,
+** so that the free space before it joins the free space after it.
+*/
+void* tlsf_move_down_ex(tlsf_t tlsf, void* ptr)
+{
+	block_header_t* block = block_from_ptr(ptr);
+	return block_is_prev_free(block)
+		? block_move_down(tlsf_cast(control_t*, tlsf), block, block_size(block)) : 0;
+}
+
+/*
+** Handle-less interface, operating on the default instance.
+*/
+
+void* tlsf_malloc(size_t size)
+{
+	return tlsf_malloc_ex(default_control, size);
+}
+
+void* tlsf_calloc(size_t count, size_t size)
+{
+	return tlsf_calloc_ex(default_control, count, size);
+}
+
+void* tlsf_malloc_tagged(unsigned int tag, size_t size)
+{
+	return tlsf_malloc_tagged_ex(default_control, tag, size);
+}
+
+void tlsf_set_tag_budget(unsigned int tag, size_t bytes)
+{
+	tlsf_set_tag_budget_ex(default_control, tag, bytes);
+}
+
+size_t tlsf_tag_used(unsigned int tag)
+{
+	return tlsf_tag_used_ex(default_control, tag);
+}
+
+void tlsf_coalesce(void)
+{
+	tlsf_coalesce_ex(default_control);
+}
+
+void* tlsf_malloc_flags(size_t size, unsigned int flags)
+{
+	return tlsf_malloc_flags_ex(default_control, size, flags);
+}
+
+void* tlsf_memalign(size_t align, size_t size)
+{
+	return tlsf_memalign_ex(default_control, align, size);
+}
+
+void tlsf_free(void* ptr)
+{
+	tlsf_free_ex(default_control, ptr);
+}
+
+void* tlsf_malloc_at_least(size_t size, size_t* actual)
+{
+	return tlsf_malloc_at_least_ex(default_control, size, actual);
+}
+
+void tlsf_free_sized(void* ptr, size_t size)
+{
+	tlsf_free_sized_ex(default_control, ptr, size);
+}
+
+int tlsf_check(void)
+{
+	return tlsf_check_ex(default_control);
+}
+
+size_t tlsf_malloc_batch(size_t size, size_t count, void** ptrs)
+{
+	return tlsf_malloc_batch_ex(default_control, size, count, ptrs);
+}
+
+void tlsf_free_batch(void** ptrs, size_t count)
+{
+	tlsf_free_batch_ex(default_control, ptrs, count);
+}
+
+void* tlsf_realloc(void* ptr, size_t size)
+{
+	return tlsf_realloc_ex(default_control, ptr, size);
+}
+
+void tlsf_fragmentation_report(tlsf_bucket_t* buckets, size_t count,
+	tlsf_fragmentation_t* report)
+{
+	tlsf_fragmentation_report_ex(default_control, buckets, count, report);
+}
+
+#ifdef TLSF_STATS
+void tlsf_get_stats(tlsf_stats_t* stats)
+{
+	tlsf_get_stats_ex(default_control, stats);
+}
+#endif
+
+#if defined (TLSF_RELEASE_HOOKS)
+void tlsf_set_release_hooks(tlsf_release_hook release, tlsf_release_hook acquire,
+	size_t granule, size_t threshold, void* user)
+{
+	tlsf_set_release_hooks_ex(default_control, release, acquire, granule, threshold, user);
+}
+#endif
+
+#ifdef TLSF_REMOTE_FREE
+void tlsf_free_remote(void* ptr)
+{
+	tlsf_free_remote_ex(default_control, ptr);
+}
+
+void tlsf_drain(void)
+{
+	tlsf_drain_ex(default_control);
+}
+#endif
+
+void* tlsf_resize(void* ptr, size_t size)
+{
+	return tlsf_resize_ex(default_control, ptr, size);
+}
+
+int tlsf_try_expand(void* ptr, size_t size)
+{
+	return tlsf_try_expand_ex(default_control, ptr, size);
+}
+
+void* tlsf_resize_move(void* ptr, size_t size)
+{
+	return tlsf_resize_move_ex(default_control, ptr, size);
+}
+
+void* tlsf_move_down(void* ptr)
+{
+	return tlsf_move_down_ex(default_control, ptr);
+}
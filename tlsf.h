@@ -16,27 +16,322 @@
 ** of the document, therefore no GPL restrictions apply.
 */
 
+#include <stdarg.h>
 #include <stddef.h>
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
-/* Create/destroy a memory pool. */
-void tlsf_create(void* mem);
-void tlsf_create_with_pool(void* mem, size_t bytes);
+/* tlsf_t: a TLSF structure. Can contain 1 to N pools. */
+/* pool_t: a block of memory that TLSF can manage. */
+typedef void* tlsf_t;
+typedef void* pool_t;
 
-/* Add/remove memory pools. */
-int tlsf_add_pool(void* mem, size_t bytes);
+/*
+** Create/destroy a memory pool. The first instance created becomes the
+** default instance used by the functions without a tlsf_t argument.
+** Destroying the default instance clears it, and the next instance created
+** takes its place. tlsf_create_with_pool returns NULL when the memory
+** cannot hold the instance and a pool.
+*/
+tlsf_t tlsf_create(void* mem);
+tlsf_t tlsf_create_with_pool(void* mem, size_t bytes);
+void tlsf_destroy(tlsf_t tlsf);
+
+/* Query/replace the default instance. */
+tlsf_t tlsf_get_default(void);
+void tlsf_set_default(tlsf_t tlsf);
+
+/*
+** Errors of tlsf_create, tlsf_create_with_pool, tlsf_add_pool,
+** tlsf_free_sized and, with TLSF_CANARY, of freeing a damaged block are
+** passed as a printf format and its arguments to the error handler of all
+** instances, which defaults to vprintf. NULL ignores them.
+*/
+typedef void (*tlsf_error_handler)(const char* format, va_list args);
+void tlsf_set_error_handler(tlsf_error_handler handler);
+
+/*
+** Overheads/limits of internal structures, which depend on the
+** TLSF_FL_INDEX_MAX, TLSF_SL_INDEX_COUNT_LOG2 and TLSF_ALIGN_SIZE_LOG2
+** build options. tlsf_size is the size of the control structure placed at
+** the start of tlsf_create's memory.
+*/
+size_t tlsf_size(void);
+size_t tlsf_align_size(void);
+size_t tlsf_block_size_min(void);
+size_t tlsf_block_size_max(void);
+size_t tlsf_pool_overhead(void);
+size_t tlsf_alloc_overhead(void);
+
+/*
+** Add/remove memory pools. tlsf_add_pool returns NULL on failure, and
+** tlsf_remove_pool returns 0 and leaves the pool in place if it is not
+** empty once deferred frees are coalesced as by tlsf_coalesce.
+** tlsf_get_pool returns the pool added by tlsf_create_with_pool.
+*/
+pool_t tlsf_get_pool(tlsf_t tlsf);
+pool_t tlsf_add_pool_ex(tlsf_t tlsf, void* mem, size_t bytes);
+int tlsf_remove_pool_ex(tlsf_t tlsf, pool_t pool);
+pool_t tlsf_add_pool(void* mem, size_t bytes);
+int tlsf_remove_pool(pool_t pool);
+
+/*
+** Add a pool whose memory is all zero. With the TLSF_ZEROED_POOLS build
+** option, tlsf_calloc skips clearing memory of such pools that has never
+** been handed out; otherwise this is the same as tlsf_add_pool.
+*/
+pool_t tlsf_add_zeroed_pool_ex(tlsf_t tlsf, void* mem, size_t bytes);
+pool_t tlsf_add_zeroed_pool(void* mem, size_t bytes);
 
 /* malloc/memalign/realloc/free replacements. */
+void* tlsf_malloc_ex(tlsf_t tlsf, size_t bytes);
+void* tlsf_memalign_ex(tlsf_t tlsf, size_t align, size_t bytes);
+void* tlsf_realloc_ex(tlsf_t tlsf, void* ptr, size_t size);
+void tlsf_free_ex(tlsf_t tlsf, void* ptr);
+
+/*
+** tlsf_calloc fails if count * size overflows. tlsf_malloc_clean is a
+** malloc that sets *dirty to the number of leading bytes that may be
+** non-zero, for callers that clear the memory themselves, e.g. outside of
+** a lock; the remaining size - *dirty bytes are known to be zero.
+*/
+void* tlsf_calloc_ex(tlsf_t tlsf, size_t count, size_t size);
+void* tlsf_malloc_clean_ex(tlsf_t tlsf, size_t size, size_t* dirty);
+
+/*
+** Sized allocation. tlsf_malloc_at_least sets *actual to the usable size
+** of the block, which the caller owns in full, or to 0 on failure.
+** tlsf_free_sized takes a size between the one requested and the one
+** usable; a block that is smaller than size is reported like a damaged
+** canary and not freed. The size is only checked here: merging needs the
+** block header anyway, so it costs the same as tlsf_free. The heap layer
+** uses it to skip front-end lookups, see tlsf_heap_free_sized.
+*/
+void* tlsf_malloc_at_least_ex(tlsf_t tlsf, size_t size, size_t* actual);
+void tlsf_free_sized_ex(tlsf_t tlsf, void* ptr, size_t size);
+
+/*
+** Batch allocation: tlsf_malloc_batch stores up to count blocks of the
+** given size in ptrs and returns how many it got, carving them from as few
+** free blocks as possible. tlsf_free_batch frees count pointers (NULLs are
+** skipped) and reorders the array by address to merge neighbours at once.
+*/
+size_t tlsf_malloc_batch_ex(tlsf_t tlsf, size_t size, size_t count, void** ptrs);
+void tlsf_free_batch_ex(tlsf_t tlsf, void** ptrs, size_t count);
+
+/*
+** Allocation flags. TLSF_BEST_FIT first looks for a fitting block in the
+** list of the exact request size, scanning at most TLSF_BEST_FIT_SCAN
+** blocks, before the O(1) good-fit search that rounds the request up to
+** the next list and so wastes up to 1/SL_INDEX_COUNT of the block.
+** tlsf_set_flags_ex sets the flags used by the calls that take none
+** (malloc, memalign, realloc and batch allocation); the default is 0.
+*/
+#define TLSF_BEST_FIT (1U << 0)
+
+void* tlsf_malloc_flags_ex(tlsf_t tlsf, size_t bytes, unsigned int flags);
+void tlsf_set_flags_ex(tlsf_t tlsf, unsigned int flags);
+unsigned int tlsf_get_flags_ex(tlsf_t tlsf);
+
+/*
+** Resize an allocation in place, without copying. Returns NULL and leaves
+** the allocation untouched if the block cannot be grown without moving it.
+*/
+void* tlsf_resize_ex(tlsf_t tlsf, void* ptr, size_t size);
+
+/*
+** Grow an allocation in place to hold at least size bytes, for containers
+** that want to use spare capacity without paying for a copy. Returns
+** nonzero on success; on failure nothing is changed. Never shrinks.
+*/
+int tlsf_try_expand_ex(tlsf_t tlsf, void* ptr, size_t size);
+
+/*
+** Resize an allocation using only its free neighbours: in place like
+** tlsf_resize_ex, or else by moving the data down into a free previous
+** block. Returns the new location, or NULL with the allocation untouched.
+** tlsf_realloc tries this before allocating a new block and copying.
+*/
+void* tlsf_resize_move_ex(tlsf_t tlsf, void* ptr, size_t size);
+
+/*
+** Compaction step for relocatable allocations: if the previous physical
+** block is free, move the allocation to its start, which merges the free
+** space before and after it. Returns the new location, or NULL if the
+** allocation stays where it is. The caller must update every reference.
+*/
+void* tlsf_move_down_ex(tlsf_t tlsf, void* ptr);
+
+/*
+** Allocation tags (TLSF_TAG_BITS build option): every used block records
+** the tag below tlsf_tag_count() it was allocated with, in the top bits of
+** its size field, so TLSF_FL_INDEX_MAX + TLSF_TAG_BITS must fit in a
+** size_t. The untagged calls use tag 0; realloc keeps the tag of a block.
+** tlsf_tag_used_ex returns the bytes, including headers, in used blocks of
+** a tag. A tag other than 0 may be given a budget (0: none), past which
+** its allocations and growing reallocations fail without searching; a
+** moving realloc counts the old block until it is freed. Without the
+** option there is only one tag, and tags and budgets are ignored.
+*/
+void* tlsf_malloc_tagged_ex(tlsf_t tlsf, unsigned int tag, size_t bytes);
+void tlsf_set_tag_budget_ex(tlsf_t tlsf, unsigned int tag, size_t bytes);
+size_t tlsf_tag_used_ex(tlsf_t tlsf, unsigned int tag);
+unsigned int tlsf_tag_count(void);
+unsigned int tlsf_block_tag(const void* ptr);
+
+/*
+** Deferred coalescing (TLSF_QUICK_LISTS build option): tlsf_free puts
+** blocks of the TLSF_QUICK_LISTS smallest sizes on a list for their exact
+** size, where malloc, realloc and tlsf_malloc_tagged/flags take them back
+** in O(1) without splitting or merging. Such blocks count as free in the
+** statistics but not in tlsf_fragmentation_report. A list is coalesced
+** when it holds TLSF_QUICK_DEPTH blocks, so a free coalesces at most that
+** many, and all lists are coalesced before an allocation fails, which
+** makes such an allocation take up to TLSF_QUICK_LISTS * TLSF_QUICK_DEPTH
+** frees longer. tlsf_coalesce coalesces all of them, and the blocks queued
+** by tlsf_free_remote, so call it before walking or checking a heap whose
+** frees should be settled; without either option it does nothing.
+*/
+void tlsf_coalesce_ex(tlsf_t tlsf);
+
+/* Same as above, operating on the default instance. */
 void* tlsf_malloc(size_t bytes);
+void* tlsf_calloc(size_t count, size_t size);
+void* tlsf_malloc_flags(size_t bytes, unsigned int flags);
+void* tlsf_malloc_tagged(unsigned int tag, size_t bytes);
+void tlsf_set_tag_budget(unsigned int tag, size_t bytes);
+size_t tlsf_tag_used(unsigned int tag);
+void tlsf_coalesce(void);
 void* tlsf_memalign(size_t align, size_t bytes);
 void* tlsf_realloc(void* ptr, size_t size);
 void tlsf_free(void* ptr);
+void* tlsf_malloc_at_least(size_t size, size_t* actual);
+void tlsf_free_sized(void* ptr, size_t size);
+size_t tlsf_malloc_batch(size_t size, size_t count, void** ptrs);
+void tlsf_free_batch(void** ptrs, size_t count);
+void* tlsf_resize(void* ptr, size_t size);
+void* tlsf_resize_move(void* ptr, size_t size);
+void* tlsf_move_down(void* ptr);
+int tlsf_try_expand(void* ptr, size_t size);
+
+/*
+** Free list histogram. tlsf_fragmentation_report fills up to count
+** buckets, indexed by size class (see tlsf_size_class), with the number
+** and total size of the free blocks in each list; buckets may be NULL.
+** The fragmentation index is 1000 * (1 - largest_free / free_bytes).
+** This walks all free blocks, so it is not O(1).
+*/
+typedef struct tlsf_bucket_t
+{
+	size_t count;
+	size_t bytes;
+} tlsf_bucket_t;
+
+typedef struct tlsf_fragmentation_t
+{
+	size_t free_blocks;
+	size_t free_bytes;
+	size_t largest_free;
+	unsigned int fragmentation;  /* per mille */
+} tlsf_fragmentation_t;
+
+size_t tlsf_bucket_count(void);
+void tlsf_fragmentation_report_ex(tlsf_t tlsf, tlsf_bucket_t* buckets,
+	size_t count, tlsf_fragmentation_t* report);
+void tlsf_fragmentation_report(tlsf_bucket_t* buckets, size_t count,
+	tlsf_fragmentation_t* report);
+
+#ifdef TLSF_STATS
+/*
+** Heap statistics (TLSF_STATS), kept up to date by every operation so
+** that querying them is O(1). Byte counts include the block headers.
+*/
+typedef struct tlsf_stats_t
+{
+	size_t total;           /* bytes managed by all pools */
+	size_t used;            /* bytes taken by allocations */
+	size_t free;            /* total - used */
+	size_t peak;            /* high-water mark of used */
+	size_t count;           /* number of allocations */
+	size_t largest_free;    /* largest request guaranteed to succeed */
+} tlsf_stats_t;
+
+void tlsf_get_stats_ex(tlsf_t tlsf, tlsf_stats_t* stats);
+void tlsf_get_stats(tlsf_stats_t* stats);
+#endif
+
+#ifdef TLSF_RELEASE_HOOKS
+/*
+** Release hooks (TLSF_RELEASE_HOOKS), for memory that can be decommitted
+** or powered down while it is free: whenever a free block holds at least
+** threshold bytes of whole granules (a power of two, e.g. the page or bank
+** size) beyond its header, release gets the range of those granules, and
+** acquire gets any part of it back before that memory is used again, so
+** the two alternate for every granule. Either hook may be NULL; a granule
+** of 0 turns them off. Changing the hooks acquires everything with the old
+** ones and releases the free blocks with the new ones. The hooks run inside
+** allocator calls and must not call back into the instance. Released
+** memory need not keep its contents, except that with TLSF_ZEROED_POOLS it
+** must read back as it was or as zero.
+*/
+typedef void (*tlsf_release_hook)(void* mem, size_t bytes, void* user);
+
+void tlsf_set_release_hooks_ex(tlsf_t tlsf, tlsf_release_hook release,
+	tlsf_release_hook acquire, size_t granule, size_t threshold, void* user);
+void tlsf_set_release_hooks(tlsf_release_hook release, tlsf_release_hook acquire,
+	size_t granule, size_t threshold, void* user);
+#endif
+
+#ifdef TLSF_REMOTE_FREE
+/*
+** Deferred free (TLSF_REMOTE_FREE): tlsf_free_remote is lock-free and may
+** be called concurrently with anything else, e.g. from an ISR. Queued
+** blocks are coalesced by the next malloc/memalign, by tlsf_drain or
+** tlsf_coalesce, and when a pool is removed, all of which must be
+** serialized like any other allocator call.
+*/
+void tlsf_free_remote_ex(tlsf_t tlsf, void* ptr);
+void tlsf_drain_ex(tlsf_t tlsf);
+void tlsf_free_remote(void* ptr);
+void tlsf_drain(void);
+#endif
+
+/* Returns internal block size, not original request size. */
+size_t tlsf_block_size(void* ptr);
+
+/*
+** Number of bytes usable at ptr, at least the size that was requested;
+** 0 for NULL.
+*/
+size_t tlsf_usable_size(const void* ptr);
+
+/*
+** Heap integrity checks, usable in release builds. tlsf_check validates
+** the bitmaps against the free lists, tlsf_check_pool the physical chain
+** of blocks of a pool and, with TLSF_CANARY, the guard words of used
+** blocks. Both return 0 if the heap is sound and a negative count of the
+** problems found otherwise. The heap must not change during the check.
+*/
+int tlsf_check_ex(tlsf_t tlsf);
+int tlsf_check_pool(pool_t pool);
+int tlsf_check(void);
+
+/*
+** Size classes of the free lists, for front-end caches. tlsf_size_class()
+** returns the class whose blocks all fit a request (-1 if none does),
+** tlsf_block_class() the class an allocated block is filed under when it
+** is freed, and tlsf_class_size() the smallest block size of a class.
+*/
+int tlsf_size_class(size_t bytes);
+int tlsf_block_class(void* ptr);
+size_t tlsf_class_size(int sclass);
 
 #ifdef DEVELHELP
-void tlsf_walk_pool(void *pool);
+/* Print the blocks of a pool; tlsf_walk_pool_tagged only used blocks of tag. */
+void tlsf_walk_pool(pool_t pool);
+void tlsf_walk_pool_tagged(pool_t pool, int tag);
 #endif
 
 #if defined(__cplusplus)
@@ -0,0 +1,145 @@
+#ifndef INCLUDED_tlsf_hpp
+#define INCLUDED_tlsf_hpp
+
+/*
+** C++ adapters for TLSF heaps (see tlsf-malloc.h): tlsf::allocator<T> for
+** standard containers and, with C++17, tlsf::memory_resource for
+** std::pmr containers. Both forward to the tlsf_heap_* functions of the
+** heap they are bound to, so they take its lock, use tlsf_heap_memalign
+** for types aligned beyond tlsf_align_size(), and pass the size back to
+** tlsf_heap_free_sized.
+** allocator<T> calls the heap directly, without virtual dispatch.
+**
+**     static tlsf_heap_t heap = TLSF_HEAP_INIT(NULL);
+**     std::vector<int, tlsf::allocator<int>> v{tlsf::allocator<int>(&heap)};
+**
+** Failed allocations throw std::bad_alloc, or abort() when exceptions are
+** disabled.
+*/
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define TLSF_HAVE_MEMORY_RESOURCE 1
+#endif
+#endif
+
+#include "tlsf-malloc.h"
+
+namespace tlsf {
+
+namespace detail {
+
+[[noreturn]] inline void bad_alloc()
+{
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+    throw std::bad_alloc();
+#else
+    std::abort();
+#endif
+}
+
+/* Zero-byte requests still get a unique pointer, as the standard asks. */
+inline void *allocate(tlsf_heap_t *heap, std::size_t bytes, std::size_t align)
+{
+    if (!bytes) {
+        bytes = 1;
+    }
+    void *ptr = (align <= tlsf_align_size())
+                ? tlsf_heap_malloc(heap, bytes)
+                : tlsf_heap_memalign(heap, align, bytes);
+    if (!ptr) {
+        bad_alloc();
+    }
+    return ptr;
+}
+
+} /* namespace detail */
+
+template <typename T>
+class allocator {
+public:
+    typedef T value_type;
+
+    explicit allocator(tlsf_heap_t *heap) noexcept : heap_(heap) {}
+
+    template <typename U>
+    allocator(const allocator<U> &other) noexcept : heap_(other.heap()) {}
+
+    T *allocate(std::size_t count)
+    {
+        if (count > static_cast<std::size_t>(-1) / sizeof(T)) {
+            detail::bad_alloc();
+        }
+        return static_cast<T *>(detail::allocate(heap_, count * sizeof(T),
+                                                 alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t count) noexcept
+    {
+        tlsf_heap_free_sized(heap_, ptr, count * sizeof(T));
+    }
+
+    tlsf_heap_t *heap() const noexcept
+    {
+        return heap_;
+    }
+
+private:
+    tlsf_heap_t *heap_;
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() == b.heap();
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() != b.heap();
+}
+
+#ifdef TLSF_HAVE_MEMORY_RESOURCE
+class memory_resource : public std::pmr::memory_resource {
+public:
+    explicit memory_resource(tlsf_heap_t *heap) noexcept : heap_(heap) {}
+
+    tlsf_heap_t *heap() const noexcept
+    {
+        return heap_;
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        return detail::allocate(heap_, bytes, align);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t) override
+    {
+        tlsf_heap_free_sized(heap_, ptr, bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+#if defined(__cpp_rtti) || defined(__GXX_RTTI)
+        const memory_resource *res = dynamic_cast<const memory_resource *>(&other);
+        return res && res->heap_ == heap_;
+#else
+        return this == &other;
+#endif
+    }
+
+    tlsf_heap_t *heap_;
+};
+#endif
+
+} /* namespace tlsf */
+
+#endif
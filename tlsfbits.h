@@ -3,6 +3,9 @@
 
 #if defined(__cplusplus)
 #define tlsf_decl inline
+#elif defined (__GNUC__)
+/* Not every routine is used by every configuration. */
+#define tlsf_decl static __inline__
 #else
 #define tlsf_decl static
 #endif
@@ -52,6 +55,20 @@ tlsf_decl int tlsf_fls(unsigned int word)
 	return bit - 1;
 }
 
+/* The builtins map to single instructions on 64-bit targets. */
+#define TLSF_HAVE_BITS64
+
+tlsf_decl int tlsf_ffs64(unsigned long long word)
+{
+	return __builtin_ffsll(word) - 1;
+}
+
+tlsf_decl int tlsf_fls64(unsigned long long word)
+{
+	const int bit = word ? 64 - __builtin_clzll(word) : 0;
+	return bit - 1;
+}
+
 #elif defined (_MSC_VER) && (_MSC_VER >= 1400) && (defined (_M_IX86) || defined (_M_X64))
 /* Microsoft Visual C++ support on x86/X64 architectures. */
 
@@ -154,23 +171,26 @@ tlsf_decl int tlsf_fls(unsigned int word)
 
 #endif
 
-/* Possibly 64-bit version of tlsf_fls. */
-#if defined (TLSF_64BIT)
-tlsf_decl int tlsf_fls_sizet(size_t size)
+/* 64-bit versions in terms of the 32-bit ones, if there is no builtin. */
+#if !defined (TLSF_HAVE_BITS64)
+tlsf_decl int tlsf_ffs64(unsigned long long word)
 {
-	int high = (int)(size >> 32);
-	int bits = 0;
-	if (high)
-	{
-		bits = 32 + tlsf_fls(high);
-	}
-	else
-	{
-		bits = tlsf_fls((int)size & 0xffffffff);
+	const unsigned int low = (unsigned int)(word & 0xffffffff);
+	const unsigned int high = (unsigned int)(word >> 32);
+	return low ? tlsf_ffs(low) : (high ? 32 + tlsf_ffs(high) : -1);
+}
 
-	}
-	return bits;
+tlsf_decl int tlsf_fls64(unsigned long long word)
+{
+	const unsigned int high = (unsigned int)(word >> 32);
+	return high ? 32 + tlsf_fls(high) : tlsf_fls((unsigned int)(word & 0xffffffff));
 }
+#endif
+#undef TLSF_HAVE_BITS64
+
+/* Possibly 64-bit version of tlsf_fls. */
+#if defined (TLSF_64BIT)
+#define tlsf_fls_sizet tlsf_fls64
 #else
 #define tlsf_fls_sizet tlsf_fls
 #endif
@@ -0,0 +1,351 @@
+/*
+ * Offline replay of allocation traces recorded with TLSF_MALLOC_TRACE.
+ *
+ * Reads the "T <op> <size> <align> <ptr> <old> <time>" lines printed by
+ * tlsf_malloc_trace_dump() (any other console output is ignored) and runs
+ * them against a fresh TLSF heap built from the same tlsf.c, so that field
+ * failures can be reproduced and build options compared on the host:
+ *
+ *     cc -O2 -I.. -DTLSF_SL_INDEX_COUNT_LOG2=5 tlsf-replay.c ../tlsf.c \
+ *         -o tlsf-replay
+ *     ./tlsf-replay -s 32768 uart.log
+ *
+ * -s sets the heap size (default 65536 bytes). -b writes the trace as a
+ * bench_trace[] table for BENCH_TRACE of the benchmark application
+ * instead of replaying it.
+ *
+ * Allocations that failed in the field are replayed as well; if they
+ * succeed here the block is freed again at once, as the program never
+ * owned it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlsf.h"
+
+/* must match the TLSF_TRACE_* values of tlsf-malloc.h */
+enum {
+    OP_MALLOC,
+    OP_FREE,
+    OP_REALLOC,
+    OP_MEMALIGN,
+};
+
+#define MAP_SIZE    (1UL << 16)
+
+/* recorded pointer -> replayed pointer, open addressing */
+typedef struct {
+    unsigned long key;      /* 0: empty, 1: deleted */
+    void *ptr;
+    unsigned slot;
+} map_entry_t;
+
+static map_entry_t map[MAP_SIZE];
+static unsigned *free_slots;
+static unsigned slot_count, slot_top, slot_peak;
+
+static map_entry_t *map_find(unsigned long key)
+{
+    unsigned long i = (key >> 3) * 2654435761UL;
+    for (unsigned long n = 0; n < MAP_SIZE; n++, i++) {
+        map_entry_t *e = &map[i & (MAP_SIZE - 1)];
+        if (e->key == key) {
+            return e;
+        }
+        if (!e->key) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static map_entry_t *map_insert(unsigned long key)
+{
+    unsigned long i = (key >> 3) * 2654435761UL;
+    for (unsigned long n = 0; n < MAP_SIZE; n++, i++) {
+        map_entry_t *e = &map[i & (MAP_SIZE - 1)];
+        if (e->key <= 1) {
+            e->key = key;
+            return e;
+        }
+    }
+    fprintf(stderr, "too many live allocations\n");
+    exit(1);
+}
+
+static unsigned slot_get(void)
+{
+    if (slot_top) {
+        return free_slots[--slot_top];
+    }
+    if (slot_count == 65536) {
+        fprintf(stderr, "too many live allocations for bench_op_t\n");
+        exit(1);
+    }
+    free_slots = realloc(free_slots, (slot_count + 1) * sizeof(*free_slots));
+    if (!free_slots) {
+        exit(1);
+    }
+    return slot_count++;
+}
+
+static void slot_put(unsigned slot)
+{
+    free_slots[slot_top++] = slot;
+}
+
+static tlsf_t tlsf;
+static int emit;
+static unsigned long ops, failed_field, failed_here, recovered, unknown;
+static size_t live, live_peak;
+static unsigned frag_peak;
+
+static void live_add(void *ptr, int sign)
+{
+    size_t size = tlsf_block_size(ptr);
+    live = (sign > 0) ? live + size : live - size;
+    if (live > live_peak) {
+        live_peak = live;
+    }
+}
+
+static void emit_op(const char *op, unsigned slot, unsigned long size,
+                    unsigned long align)
+{
+    printf("    { %s, %u, %lu, %lu },\n", op, slot, size, align);
+    if (slot_count > slot_peak) {
+        slot_peak = slot_count;
+    }
+}
+
+/* Forget a recorded pointer; returns its entry so the caller can free it. */
+static int release(unsigned long key, map_entry_t *out)
+{
+    map_entry_t *e = map_find(key);
+    if (!e) {
+        ++unknown;
+        return 0;
+    }
+    *out = *e;
+    e->key = 1;
+    return 1;
+}
+
+static void do_free(unsigned long key)
+{
+    map_entry_t e;
+    if (!key || !release(key, &e)) {
+        return;
+    }
+    if (emit) {
+        emit_op("BENCH_OP_FREE", e.slot, 0, 0);
+        slot_put(e.slot);
+    }
+    else if (e.ptr) {
+        live_add(e.ptr, -1);
+        tlsf_free_ex(tlsf, e.ptr);
+    }
+}
+
+static void do_alloc(int op, unsigned long size, unsigned long align,
+                     unsigned long key)
+{
+    map_entry_t *e;
+    void *ptr = NULL;
+
+    if (!key) {
+        ++failed_field;
+    }
+    else if (map_find(key)) {
+        /* an address handed out twice: the free was not recorded */
+        ++unknown;
+        do_free(key);
+    }
+
+    if (emit) {
+        if (key) {
+            e = map_insert(key);
+            e->slot = slot_get();
+            emit_op(op == OP_MEMALIGN ? "BENCH_OP_MEMALIGN" : "BENCH_OP_MALLOC",
+                    e->slot, size, align);
+        }
+        return;
+    }
+
+    ptr = (op == OP_MEMALIGN) ? tlsf_memalign_ex(tlsf, align, size)
+                              : tlsf_malloc_ex(tlsf, size);
+    if (!ptr) {
+        ++failed_here;
+    }
+    if (!key) {
+        if (ptr) {
+            ++recovered;
+            tlsf_free_ex(tlsf, ptr);
+        }
+        return;
+    }
+    if (ptr) {
+        live_add(ptr, 1);
+    }
+    e = map_insert(key);
+    e->ptr = ptr;
+}
+
+static void do_realloc(unsigned long size, unsigned long key,
+                       unsigned long old)
+{
+    map_entry_t e;
+
+    if (!old) {
+        do_alloc(OP_MALLOC, size, 0, key);
+        return;
+    }
+    if (!size) {
+        do_free(old);
+        return;
+    }
+    if (!key) {
+        /* failed in the field, the old block stays */
+        ++failed_field;
+        return;
+    }
+    if (!release(old, &e)) {
+        do_alloc(OP_MALLOC, size, 0, key);
+        return;
+    }
+
+    if (emit) {
+        map_entry_t *n = map_insert(key);
+        n->slot = e.slot;
+        emit_op("BENCH_OP_REALLOC", e.slot, size, 0);
+        return;
+    }
+
+    void *ptr = e.ptr;
+    if (ptr) {
+        live_add(ptr, -1);
+        void *moved = tlsf_realloc_ex(tlsf, ptr, size);
+        if (moved) {
+            ptr = moved;
+        }
+        else {
+            ++failed_here;
+        }
+        live_add(ptr, 1);
+    }
+    else {
+        ptr = tlsf_malloc_ex(tlsf, size);
+        if (ptr) {
+            live_add(ptr, 1);
+        }
+    }
+    map_entry_t *n = map_insert(key);
+    n->ptr = ptr;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s heap_bytes] [-b] [trace]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    size_t heap_size = 65536;
+    FILE *in = stdin;
+    char line[256];
+    void *heap;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            heap_size = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "-b")) {
+            emit = 1;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if (i + 1 < argc) {
+        usage(argv[0]);
+    }
+    if (i < argc && !(in = fopen(argv[i], "r"))) {
+        perror(argv[i]);
+        return 1;
+    }
+
+    heap = malloc(tlsf_size() + tlsf_pool_overhead() + heap_size);
+    if (!heap) {
+        return 1;
+    }
+    tlsf = tlsf_create_with_pool(heap, tlsf_size() + tlsf_pool_overhead() +
+                                 heap_size);
+    if (!tlsf) {
+        fprintf(stderr, "cannot create a heap of %lu bytes\n",
+                (unsigned long)heap_size);
+        return 1;
+    }
+
+    if (emit) {
+        printf("static const bench_op_t bench_trace[] = {\n");
+    }
+
+    while (fgets(line, sizeof(line), in)) {
+        unsigned op;
+        unsigned long size, align, ptr, old, time;
+        tlsf_fragmentation_t report;
+
+        if (sscanf(line, "T %u %lu %lu %lx %lx %lu", &op, &size, &align, &ptr,
+                   &old, &time) != 6) {
+            if (!strncmp(line, "# lost", 6)) {
+                fprintf(stderr, "warning: trace is incomplete: %s", line);
+            }
+            continue;
+        }
+
+        ++ops;
+        switch (op) {
+        case OP_MALLOC:
+        case OP_MEMALIGN:
+            do_alloc(op, size, align, ptr);
+            break;
+        case OP_FREE:
+            do_free(ptr);
+            break;
+        case OP_REALLOC:
+            do_realloc(size, ptr, old);
+            break;
+        default:
+            --ops;
+            continue;
+        }
+
+        if (!emit) {
+            tlsf_fragmentation_report_ex(tlsf, NULL, 0, &report);
+            if (report.fragmentation > frag_peak) {
+                frag_peak = report.fragmentation;
+            }
+        }
+    }
+
+    if (emit) {
+        printf("};\n/* %lu operations, needs BENCH_SLOTS >= %u */\n", ops,
+               slot_peak);
+        return 0;
+    }
+
+    printf("operations:           %lu\n", ops);
+    printf("failed in the field:  %lu\n", failed_field);
+    printf("failed in replay:     %lu\n", failed_here);
+    printf("recovered in replay:  %lu\n", recovered);
+    printf("unmatched pointers:   %lu\n", unknown);
+    printf("peak live bytes:      %lu of %lu\n", (unsigned long)live_peak,
+           (unsigned long)heap_size);
+    printf("peak fragmentation:   %u.%u%%\n", frag_peak / 10, frag_peak % 10);
+    return failed_here ? 2 : 0;
+}